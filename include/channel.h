@@ -0,0 +1,60 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include "main.h"
+
+#include <stdint.h>
+
+#define CHANNEL_CAPACITY 4096	// words, has to be a power of 2
+#define CHANNEL_BATCH 32	// words handed over at a time, one cache line of slots
+#define CHANNEL_SPINS 1024	// how long an empty or full channel is polled before the thread parks
+#define CHANNEL_CLOSED 0xFFFF	// what receiving gives once the sender is gone and everything it sent has been read
+
+#define CHANNEL_LINE 64	// keeps each side's fields on their own cache line
+
+// bounded single producer single consumer ring, one thread sends and one thread receives
+// the indices only ever count up and wrap, the slot is the index masked by the capacity
+typedef struct Channel{
+	// written by the producer
+	_Alignas(CHANNEL_LINE) uint32_t head;	// words the consumer is allowed to read
+	uint32_t closed;
+	// written by the consumer
+	_Alignas(CHANNEL_LINE) uint32_t tail;	// words the producer is allowed to overwrite
+	uint32_t abandoned;
+	// only written around parking so both sides can read them cheaply
+	_Alignas(CHANNEL_LINE) uint32_t producerParked;
+	uint32_t consumerParked;
+	uint32_t producerSignal;	// futex words, bumped to wake the other side
+	uint32_t consumerSignal;
+	// the producer's own view
+	_Alignas(CHANNEL_LINE) uint32_t writeIndex;
+	uint32_t tailSeen;
+	// the consumer's own view
+	_Alignas(CHANNEL_LINE) uint32_t readIndex;
+	uint32_t headSeen;
+	// read only once made
+	_Alignas(CHANNEL_LINE) BITSIZE *slots;
+	uint32_t mask;
+} Channel;
+
+// status port bits
+#define CHANNEL_STATUS_READY 0x1	// a receive won't block
+#define CHANNEL_STATUS_FULL 0x2	// a send would block
+#define CHANNEL_STATUS_CLOSED 0x4	// the sender is gone and there is nothing left to receive
+
+Channel *channelCreate(void);
+void channelFree(Channel *channel);
+
+// producer side
+void channelSend(Channel *channel, BITSIZE value);
+void channelFlush(Channel *channel);
+void channelClose(Channel *channel);
+
+// consumer side
+int channelTryReceive(Channel *channel, BITSIZE *value);
+int channelReceive(Channel *channel, BITSIZE *value);
+void channelAbandon(Channel *channel);
+
+BITSIZE channelStatus(Channel *inbound, Channel *outbound);
+
+#endif
@@ -3,16 +3,90 @@
 
 #include "main.h"
 
+#include <stdint.h>
+
 // forward declarations
 typedef struct Token Token;
 
 typedef struct Bytecode{
-	BITSIZE code[MAXSIZE];
+	BITSIZE *code;	// grows while compiling, only the first codeLen words are used
+	uint32_t *lines;	// source line for every word in code, grows alongside it
 
 	size_t codeLen;
+	size_t capacity;
 	size_t maxSize;	// used to store only MAXSIZE, this can be used to retrieve the BITSIZE if running from an output binary file in the future
+
+	// initialized memory from the data directives, indexed by address so .org can move around freely
+	// only dataBase up to dataEnd was ever written, it gets copied into memory when a VM starts
+	BITSIZE *data;
+	size_t dataBase;
+	size_t dataEnd;
+	size_t dataCapacity;
 } Bytecode;
 
+// what a label marks, code labels are jumped to and data labels are memory addresses
+typedef enum LabelKind{
+	LABEL_CODE = 0,
+	LABEL_DATA,
+	LABEL_ANY	// only for references, #label takes either
+} LabelKind;
+
+// table and entry for storing labels while compiling
+typedef struct{
+	char *name;
+	size_t address;
+	size_t line;
+	LabelKind kind;
+} LabelEntry;
+
+typedef struct{
+	LabelEntry *items;
+	size_t count;
+	size_t capacity;
+} LabelTable;
+
+// table and entry for storing patches while compiling
+typedef struct{
+	char *name;
+	size_t index;
+	size_t line;
+	LabelKind kind;	// what the label has to be
+} PatchEntry;
+
+typedef struct{
+	PatchEntry *items;
+	size_t count;
+	size_t capacity;
+} PatchTable;
+
+// everything the assembler keeps between lines, lets a session be fed a piece at a time
+typedef struct Assembler{
+	Bytecode *bytecode;
+	LabelTable labels;
+	PatchTable patches;	// jumps to labels that haven't been declared yet
+	int relocatable;	// leave every jump as a patch so the code can be moved by the linker
+	size_t dataCursor;	// where the next data directive puts its words, moved with .org
+	int dataFixed;	// a .org chose where the data goes, so the linker leaves it at those addresses
+
+	// data written by the last feed, the REPL copies it straight into memory
+	size_t fedDataBase;
+	size_t fedDataEnd;
+} Assembler;
+
 Bytecode *compiler(Token *tokens);
 
+// incremental interface, used by the REPL to assemble one line at a time
+Assembler *assemblerCreate(void);
+int assemblerFeed(Assembler *assembler, Token *tokens);
+Bytecode *assemblerBytecode(const Assembler *assembler);
+size_t assemblerPending(const Assembler *assembler);
+Bytecode *assemblerFinish(Assembler *assembler);
+
+// pieces used by the linker to merge relocatable objects
+Assembler *compilerObject(Token *tokens);
+void assemblerAppend(Assembler *assembler, const BITSIZE *code, const uint32_t *lines, size_t len);
+void assemblerDefine(Assembler *assembler, char *name, size_t address, size_t line, LabelKind kind);
+void assemblerReference(Assembler *assembler, char *name, size_t index, size_t line, LabelKind kind);
+void assemblerPlaceData(Assembler *assembler, size_t address, const BITSIZE *words, size_t count, size_t line);
+
 #endif
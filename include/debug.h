@@ -0,0 +1,38 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include "main.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEBUG_MAX_BREAKPOINTS 64
+#define DEBUG_LINE_SIZE 256	// longer commands get cut off
+
+// forward declarations
+typedef struct VM VM;
+typedef struct Program Program;
+typedef struct VMOptions VMOptions;
+
+// the word a BRK replaced, put back while stepping over it and when it gets deleted
+typedef struct Breakpoint{
+	BITSIZE address;
+	BITSIZE original;
+} Breakpoint;
+
+typedef struct Debugger{
+	VM *vm;
+	BITSIZE *code;	// private copy the VM runs, breakpoints get patched into it so the program itself is never touched
+	uint8_t *starts;	// 1 where an instruction starts, the only places a breakpoint can go
+	Breakpoint breakpoints[DEBUG_MAX_BREAKPOINTS];
+	size_t breakpointCount;
+	const char *sourcePath;
+	int finished;	// halted, ran off the end or hit an error, only inspecting is left
+	int failed;	// it was an error
+} Debugger;
+
+// runs a program under a prompt reading commands from stdin, between breakpoints it runs as fast as it normally would
+// returns -1 if the program stopped on an error
+int debugRun(Program *program, const VMOptions *options);
+
+#endif
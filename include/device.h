@@ -0,0 +1,61 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include "main.h"
+
+// the top page of memory is reserved for memory mapped devices
+#define DEVICE_BASE 0xFF00
+#define DEVICE_COUNT 256
+
+// ports with a device attached by default
+#define PORT_CONSOLE 0xFF00	// writing prints the low byte as an ASCII character
+#define PORT_INPUT 0xFF01	// reading gives the next input byte, or INPUT_EOF once the input is used up
+#define PORT_INPUT_STATUS 0xFF02	// reading gives 1 once the input is used up, 0 while there is more
+#define PORT_CORE_ID 0xFF10	// reading gives which core this is when running SPMD, 0 otherwise
+#define PORT_CORE_COUNT 0xFF11	// reading gives how many cores are running
+#define PORT_CHANNEL_SEND 0xFF20	// writing sends the word to the next pipeline stage
+#define PORT_CHANNEL_RECEIVE 0xFF21	// reading waits for a word from the previous stage, CHANNEL_CLOSED once it has halted
+#define PORT_CHANNEL_STATUS 0xFF22	// reading gives the CHANNEL_STATUS bits
+#define PORT_MAP_BANK 0xFF30	// writing slides the mapped file window to that bank, reading gives the current one
+#define PORT_MAP_BANKS 0xFF31	// reading gives how many banks the mapped file has
+
+#define INPUT_EOF 0xFFFF
+#define CONSOLE_CHUNK 4096	// bytes narrowed at a time for bulk output
+#define INPUT_BUFFER_SIZE (64 * 1024)
+
+// forward declarations
+typedef struct VM VM;
+
+// handlers for a single port, context is whatever was handed over when the device was registered
+typedef BITSIZE (*DeviceRead)(VM *vm, void *context, BITSIZE port);
+typedef void (*DeviceWrite)(VM *vm, void *context, BITSIZE port, BITSIZE value);
+
+typedef struct Device{
+	DeviceRead read;	// NULL means reads see the last value written to the port
+	DeviceWrite write;	// NULL means writes just land in memory
+	void *context;
+} Device;
+
+// buffered reader behind the input ports, the buffer is only allocated once something is read
+typedef struct InputDevice{
+	int fd;
+	unsigned char *buffer;
+	size_t start;	// next unread byte
+	size_t end;	// one past the last buffered byte
+	int eof;
+} InputDevice;
+
+void deviceInit(VM *vm);
+void deviceFree(VM *vm);
+int deviceRegister(VM *vm, BITSIZE port, DeviceRead read, DeviceWrite write, void *context);
+
+BITSIZE deviceRead(VM *vm, BITSIZE port);
+void deviceWrite(VM *vm, BITSIZE port, BITSIZE value);
+
+void deviceBeforeWait(VM *vm);
+
+size_t inputReadBulk(InputDevice *input, BITSIZE *dest, size_t count);
+int inputReadLine(InputDevice *input, char *line, size_t capacity);
+void consoleWriteBulk(VM *vm, const BITSIZE *src, size_t len);
+
+#endif
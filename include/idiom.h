@@ -0,0 +1,29 @@
+#ifndef IDIOM_H
+#define IDIOM_H
+
+#include "main.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the loops that get folded, kept in the dest field of the OP_LOOP word that replaces the DEC at the top
+// every one of them only changes ACC and the PC, so running it comes down to working out where the count ends
+typedef enum Idiom{
+	IDIOM_NONE = 0,
+	IDIOM_DEC_JGZ,	// L: DEC, JGZ L		goes on while ACC > 0
+	IDIOM_DEC_JLZ,	// L: DEC, JLZ X, JMP L	leaves for X once ACC < 0, the countdown in the README
+	IDIOM_DEC_JEZ	// L: DEC, JEZ X, JMP L	leaves for X once ACC == 0
+} Idiom;
+
+// which loop starts at pc in unfolded code, IDIOM_NONE when there isn't one or it would run past codeLen
+Idiom idiomMatch(const BITSIZE *code, size_t codeLen, size_t pc);
+
+// a copy of verified code with the top of every loop it recognizes swapped for OP_LOOP, made with malloc
+// returns NULL when there is nothing to fold so the code can be used as it is
+BITSIZE *idiomFold(const BITSIZE *code, size_t codeLen);
+
+// what running a folded loop from the top with ACC = acc comes to
+// instructions is how many the loop would have dispatched, acc ends up as it would have when the loop is left
+void idiomCountdown(Idiom idiom, BITSIZE *acc, uint64_t *instructions);
+
+#endif
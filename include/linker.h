@@ -0,0 +1,21 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include "main.h"
+
+// forward declarations
+typedef struct Assembler Assembler;
+typedef struct Bytecode Bytecode;
+
+// magic at the start of a relocatable object, followed by the format version
+#define OBJECT_MAGIC "LXOB"
+#define OBJECT_VERSION 3
+
+#define OBJECT_DATA_FIXED 0x1	// header flag, the data was put at its addresses with .org and can't be moved
+
+int objectWrite(const Assembler *object, const char *path);
+int objectIsObject(const char *path);
+
+Bytecode *linker(const char **paths, size_t count);
+
+#endif
@@ -18,7 +18,7 @@ typedef enum Opcode{
 	OP_ST,		// takes in 2 arguements, source_reg -> dest_reg the order here is opposite normal
 	OP_PUSH,	// takes in 1 arguement, source_reg where the value being added to the stack is stored
 	OP_POP,		// takes in 1 arguement, dest_reg where the value form the top of the stack will go
-	OP_ADD,		// takes in 1 arguement, source_reg which the accumulator will be incemented by
+	OP_ADD,		// takes in 1 arguement, source_reg (or immd_value for every ALU op) which the accumulator will be incemented by
 	OP_SUB,		// takes in 1 arguement, source_reg which the accumulator will be decremented by
 	OP_MUL,		// takes in 1 arguement, source_reg which the accumulator will be multiplied by
 	OP_DIV,		// takes in 1 arguement, source_reg which the accumulator will be divided by
@@ -35,7 +35,36 @@ typedef enum Opcode{
 	OP_JGZ,		// takes in 1 arguement, label which will be jumped to if accumulator > 0
 	OP_PRN,		// takes in 1 arguement, source_reg which will be moved to [0xFF00] and be printed
 	OP_HLT,		// no arguements, only halts the cpu no way to undo this so just use it to exit
-	OP_NOP		// no arguements, what do you want me to tell you it just does nothing
+	OP_NOP,		// no arguements, what do you want me to tell you it just does nothing
+	OP_VADD,	// takes in 3 arguements, dest_base_reg, src_base_reg, len_reg, memory[dest + i] += memory[src + i] for each i < len
+	OP_VSUB,	// takes in 3 arguements, same as VADD but subtracts
+	OP_VMUL,	// takes in 3 arguements, same as VADD but multiplies
+	OP_VAND,	// takes in 3 arguements, same as VADD but bitwise "ands"
+	OP_VXOR,	// takes in 3 arguements, same as VADD but bitwise "xors"
+	OP_VSUM,	// takes in 2 arguements, src_base_reg, len_reg, accumulator is set to the sum of the range
+	OP_CALL,	// takes in 1 arguement, label which will be jumped to after pushing the return address onto the stack
+	OP_RET,		// no arguements, pops the return address off the stack and jumps back to it
+	OP_RDS,		// takes in 2 arguements, addr_reg, len_reg, reads up to len input bytes into memory starting at addr, accumulator is set to how many were read
+	OP_XCHG,	// takes in 2 arguements, reg, addr_reg, atomically swaps reg with memory[addr]
+	OP_CAS,		// takes in 2 arguements, reg, addr_reg, atomically stores reg at memory[addr] if it still equals the accumulator, accumulator is set to 1 if it did 0 if not and reg gets the old value
+	OP_FADD,	// takes in 2 arguements, reg, addr_reg, atomically adds reg to memory[addr], reg gets the old value
+	OP_BAR,		// no arguements, waits until every other core has reached a BAR or halted
+	OP_PRS,		// takes in 2 arguements, addr_reg, len_reg, prints the low byte of every word in memory[addr] to memory[addr + len - 1] in one write
+	OP_PRZ,		// takes in 1 arguement, addr_reg, prints memory from addr up to the first 0 word, accumulator is set to how many were printed
+	OP_MOD,		// takes in 1 arguement, source_reg or immd_value, accumulator is set to the remainder of dividing by it (sign follows the accumulator)
+	OP_SHL,		// takes in 1 arguement, source_reg or immd_value, accumulator is shifted left by it
+	OP_SHR,		// takes in 1 arguement, source_reg or immd_value, accumulator is shifted right by it filling with 0s
+	OP_SAR,		// takes in 1 arguement, source_reg or immd_value, accumulator is shifted right by it filling with the sign bit
+	OP_ROL,		// takes in 1 arguement, source_reg or immd_value, accumulator is rotated left by it
+	OP_CMP,		// takes in 2 arguements, reg, source_reg or immd_value, sets the flags from comparing reg against it, accumulator is untouched
+	OP_JEQ,		// takes in 1 arguement, label which will be jumped to if the last CMP was equal
+	OP_JNE,		// takes in 1 arguement, label which will be jumped to if the last CMP was not equal
+	OP_JLT,		// takes in 1 arguement, label which will be jumped to if the last CMP was less than (signed)
+	OP_JGE,		// takes in 1 arguement, label which will be jumped to if the last CMP was greater or equal (signed)
+	OP_JLTU,	// takes in 1 arguement, label which will be jumped to if the last CMP was less than (unsigned)
+	OP_JGEU,	// takes in 1 arguement, label which will be jumped to if the last CMP was greater or equal (unsigned)
+	OP_BRK,		// reserved for the debugger, patched over an instruction in its private copy of the code, never assembled
+	OP_LOOP		// internal, takes the place of the DEC at the top of a countdown loop in the code a VM runs, see idiomFold
 } Opcode;
 
 // registers will be stored as a value of this enum
@@ -0,0 +1,28 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include "main.h"
+
+#include <stddef.h>
+
+// forward declarations
+typedef struct VM VM;
+
+// a host file shown through a window of VM memory one bank (window sized slice of the file) at a time
+// the file is read as 16 bit words in host byte order, anything past its end reads as 0
+typedef struct Mapping{
+	int fd;
+	size_t fileSize;	// bytes
+	BITSIZE base;	// where the window starts in VM memory
+	size_t words;	// how big the window (and so each bank) is
+	int readOnly;	// writes into the window are a VM error, otherwise they only change this VM's copy
+	BITSIZE bank;	// which slice is showing
+	BITSIZE bankCount;
+} Mapping;
+
+// opens path and shows bank 0 in the window, returns NULL if the file can't be opened or the window doesn't fit
+Mapping *mappingCreate(VM *vm, const char *path, BITSIZE base, size_t words, int readOnly);
+int mappingSelect(VM *vm, Mapping *mapping, BITSIZE bank);
+void mappingFree(Mapping *mapping);
+
+#endif
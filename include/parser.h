@@ -6,9 +6,11 @@
 typedef enum TokenType{
 	TOKEN_OP = 0,	// first token on line
 	TOKEN_REG,	// must start with `R` or `r` followed by a number 0 - 7 or special keywords `SP`, `PC`, or `ACC`
-	TOKEN_IMMD,	// first character of token is `#` then a integer value (max size depends on vm settings)
-	TOKEN_ADDR,	// first character of token is `[` then address in hex or integer followed by `]` close
+	TOKEN_IMMD,	// first character of token is `#` then a integer value (max size depends on vm settings) or a label name
+	TOKEN_ADDR,	// first character of token is `[` then address in hex or integer (or a data label) followed by `]` close
 	TOKEN_LABEL,	// first character of token is `@` then the label name followed by a `:`
+	TOKEN_DIRECTIVE,	// first token on line starting with `.` like `.org` or `.word`, tells the assembler where and what data to lay out
+	TOKEN_STRING,	// text between `"` quotes, escapes are left as is for the compiler to decode
 	TOKEN_END	// only for the end file, denotes end of program
 } TokenType;
 
@@ -26,5 +28,6 @@ typedef struct Token{
 } Token;
 
 Token *parser(char *pathToFile);
+Token *parserString(const char *source, size_t firstLine);
 
 #endif
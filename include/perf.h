@@ -0,0 +1,33 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// host counters read around a run
+typedef enum PerfCounter{
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_BRANCH_MISSES,
+	PERF_L1D_MISSES,
+	PERF_COUNTER_COUNT
+} PerfCounter;
+
+typedef struct PerfCounters{
+	int fds[PERF_COUNTER_COUNT];	// -1 for counters that couldn't be opened
+	uint64_t values[PERF_COUNTER_COUNT];
+	unsigned supported;	// bit per counter that could be opened, 0 means only the timestamp fallback is used
+	int openError;	// errno from the first counter that failed
+
+	// always taken, used for wall time and as the fallback when no counters are allowed
+	uint64_t startTicks;
+	uint64_t ticks;
+	uint64_t startNanos;
+	uint64_t nanos;
+} PerfCounters;
+
+void perfStart(PerfCounters *perf);
+void perfStop(PerfCounters *perf);
+void perfReport(const PerfCounters *perf, uint64_t vmInstructions, FILE *out);
+
+#endif
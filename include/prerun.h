@@ -0,0 +1,36 @@
+#ifndef PRERUN_H
+#define PRERUN_H
+
+#include "main.h"
+#include "device.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PRERUN_DEFAULT_LIMIT (1u << 26)	// instructions run ahead of time before giving up and starting there anyway
+
+// forward declarations
+typedef struct VM VM;
+typedef struct Program Program;
+
+// state of a VM that is running a program ahead of time
+typedef struct Prerun{
+	uint8_t known[MAXSIZE / 8];	// one bit per word of memory, set once its value can't depend on anything outside the program
+	uint64_t limit;
+
+	// everything printed so far, made with malloc since it only lives as long as the prerun
+	unsigned char *output;
+	size_t outputLen;
+	size_t outputCapacity;
+} Prerun;
+
+// called by the VM before every instruction while prerunning, returns 0 if the instruction depends on input,
+// a device, other cores or memory the program never wrote, and so has to wait for the real run
+int prerunAllows(VM *vm, BITSIZE pc, Opcode opcode, int destField, int srcField);
+
+// runs the program up to the first instruction that has to wait for the real run, then returns a copy that starts there
+// the memory it wrote becomes the data segment and what it printed gets printed again when the copy starts
+// returns the program itself (with another reference) if nothing could be run ahead of time
+Program *prerunProgram(Program *program, uint64_t limit);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "main.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROFILE_DEFAULT_HZ 997	// prime so it doesn't line up with loops that run on a timer of their own
+#define PROFILE_DEFAULT_PATH "lexi.profile"
+#define PROFILE_DEPTH 32	// frames kept per sample, the outermost ones win and the rest get folded into "..."
+#define PROFILE_SLOTS 4096	// distinct stacks a single VM can tell apart, a power of 2
+#define PROFILE_FRAME_WORDS (1u << 16)	// room for the frames of every distinct stack
+
+// forward declarations
+typedef struct VM VM;
+
+// one distinct stack and how often it was seen
+typedef struct ProfileSlot{
+	uint32_t hash;	// 0 marks an empty slot
+	uint16_t depth;
+	uint16_t truncated;	// the shadow stack was deeper than PROFILE_DEPTH
+	uint32_t offset;	// into frames
+	uint64_t count;
+} ProfileSlot;
+
+// samples for one VM, only ever written by the signal handler on that VM's own thread while it is running
+// everything is allocated up front so the handler never has to, once it's full new stacks are counted as dropped
+typedef struct ProfileSamples{
+	const char *source;	// labels the frames, not copied so it has to outlive the VM like the rest of its options
+	ProfileSlot slots[PROFILE_SLOTS];
+	BITSIZE frames[PROFILE_FRAME_WORDS];	// return addresses root first, then the PC that was running
+	uint32_t framesUsed;
+	uint32_t slotsUsed;
+	uint64_t dropped;
+} ProfileSamples;
+
+// one folded stack, frames already turned into source lines
+typedef struct ProfileStack{
+	char *folded;
+	uint64_t count;
+} ProfileStack;
+
+// samples merged from every VM, stacks with the same text are added together
+typedef struct Profile{
+	ProfileStack *stacks;
+	size_t stackCount;
+	size_t *table;	// open addressing into stacks, index + 1 so 0 can mean empty
+	size_t tableSize;
+	uint64_t samples;
+	uint64_t dropped;
+} Profile;
+
+Profile *profileCreate(void);
+void profileFree(Profile *profile);
+
+ProfileSamples *profileSamplesCreate(const char *source);
+void profileSamplesFree(ProfileSamples *samples);
+// folds a VM's samples into the shared profile, lines turns the addresses into source lines
+void profileMerge(Profile *into, const ProfileSamples *from, const uint32_t *lines, size_t codeLen);
+
+// arms ITIMER_PROF so every busy VM thread gets sampled hz times a second of cpu time, returns 0 if the timer couldn't be set
+int profileStart(unsigned hz);
+void profileStop(void);
+
+// writes one "frame;frame;frame count" line per stack, the format flame graph tools read
+int profileWrite(const Profile *profile, const char *path);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "main.h"
+#include "device.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// forward declarations
+typedef struct Bytecode Bytecode;
+
+// magic at the start of a saved program image, followed by the format version
+#define IMAGE_MAGIC "LEXI"
+#define IMAGE_VERSION 4
+
+// machine state a partially evaluated program picks up from instead of starting at PC 0, see prerunProgram
+typedef struct ProgramStart{
+	uint32_t stackCount;
+	uint32_t outputLen;	// bytes the skipped instructions printed, they get printed again when a VM starts
+	BITSIZE registers[REG_ACC + 1];
+	uint16_t flags;
+	BITSIZE page[DEVICE_COUNT];	// the top page of memory, which is where the stack starts
+	unsigned char output[];
+} ProgramStart;
+
+// a stretch of initialized memory, its words come right after those of the runs before it
+typedef struct DataRun{
+	uint32_t base;
+	uint32_t len;
+} DataRun;
+
+// an immutable compiled program, any number of VMs on any number of threads can share one
+// only the reference count ever changes after creation
+typedef struct Program{
+	const BITSIZE *code;
+	size_t codeLen;
+	const uint32_t *lines;	// source line each code word came from, same length as code
+	const BITSIZE *runCode;	// what VMs run, code with its countdown loops folded or just code when there were none
+
+	// initialized memory, each run is copied to its base when a VM starts and whatever lies between runs is left alone
+	const DataRun *runs;
+	size_t runCount;
+	const BITSIZE *data;	// the words of every run one after another
+	size_t dataLen;
+
+	// NULL runs from the beginning
+	const ProgramStart *start;
+	size_t startSize;	// bytes, including the output
+
+	atomic_size_t refCount;
+
+	// set when the image is mapped from a file instead of living in one malloc block
+	void *mapping;
+	size_t mappingSize;
+} Program;
+
+Program *programCreate(const Bytecode *bytecode);
+Program *programWithStart(const Program *program, const DataRun *runs, size_t runCount, const BITSIZE *data, const ProgramStart *start);
+Program *programLoad(const char *path);
+int programIsImage(const char *path);
+int programSave(const Program *program, const char *path);
+
+Program *programRetain(Program *program);
+void programRelease(Program *program);
+
+#endif
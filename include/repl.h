@@ -0,0 +1,14 @@
+#ifndef REPL_H
+#define REPL_H
+
+// forward declarations
+typedef struct VMOptions VMOptions;
+typedef struct VM VM;
+
+int repl(const char *preloadPath, const VMOptions *options);
+
+// the :regs and :mem commands, the debugger has them too
+void replPrintRegisters(const VM *vm);
+void replPrintMemory(const VM *vm, const char *args);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <stddef.h>
+
+#define SCRATCH_CHUNK (64 * 1024)	// bytes asked of malloc at a time, anything bigger gets a chunk to itself
+
+// a block of memory that gets handed out front to back
+typedef struct ScratchChunk{
+	struct ScratchChunk *next;	// the one filled before this
+	size_t size;	// bytes after the header
+	size_t used;
+} ScratchChunk;
+
+// bump allocator for everything the parser, compiler and linker make for one compilation
+// none of it is freed on its own, the whole lot goes at once when the compilation is over
+typedef struct Scratch{
+	ScratchChunk *chunks;	// newest first, only the newest one is handed out from
+	void *last;	// the latest allocation, the only one that can grow where it is
+	size_t lastSize;
+	size_t used;	// bytes handed out, including what growing in place added
+	size_t reserved;	// bytes taken from malloc
+	struct Scratch *outer;	// what was active before this one started
+} Scratch;
+
+// starts a compilation, scratchAlloc hands out memory from it on this thread until scratchEnd
+Scratch *scratchBegin(void);
+// frees everything handed out since scratchBegin in one go
+void scratchEnd(Scratch *scratch);
+size_t scratchUsed(const Scratch *scratch);
+
+// memory from the active scratch (always zeroed), or from the gc when there is none, like in the REPL where things outlive a line
+void *scratchAlloc(size_t size);
+// makes an allocation bigger, in place when it's the latest one and there's room, otherwise it's copied
+void *scratchGrow(void *memory, size_t oldSize, size_t newSize);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define SERVE_MAGIC 0x4958454C	// "LEXI" read as a little endian word
+#define SERVE_CACHE_SIZE 64	// compiled programs kept warm, the oldest one goes first
+#define SERVE_MAX_REQUEST (1024 * 1024)	// bytes of cwd and arguments a client can send
+
+// forward declarations
+typedef struct Program Program;
+
+// the fixed part of a request, followed by the client's cwd and then every argument, each ending in a 0
+// the client's stdin, stdout and stderr ride along with it as SCM_RIGHTS
+typedef struct ServeRequest{
+	uint32_t magic;
+	uint32_t length;	// bytes after this header
+	uint32_t argc;
+} ServeRequest;
+
+// the only reply, sent once the run is over, it's the exit code the command would have had
+typedef struct ServeReply{
+	uint32_t magic;
+	int32_t status;
+} ServeReply;
+
+// a compiled program and the file it came from, it's stale once the file changes
+typedef struct ServeEntry{
+	char *path;	// made absolute with realpath
+	dev_t device;
+	ino_t inode;
+	off_t size;
+	struct timespec modified;
+	Program *program;
+} ServeEntry;
+
+// runs a whole command line the same way main would, the server calls it in a child for every request
+typedef int (*ServeCommand)(int argc, char **argv);
+// compiles a source file and saves it as an image, called in a child so compile errors can't take the server down
+typedef int (*ServeCompile)(const char *sourcePath, const char *imagePath);
+
+// accepts requests on a Unix socket until killed, every run gets its own process forked from the warm server
+int serveRun(const char *socketPath, ServeCommand command, ServeCompile compile);
+
+// sends the rest of the command line to a server and exits with whatever the run did
+int serveClient(const char *socketPath, int argc, char **argv);
+
+// the warm copy of a compiled source file if the server has one, with another reference, NULL otherwise
+Program *serveCacheFind(const char *path);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SPMD_H
+#define SPMD_H
+
+#include "main.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+// how many VMs a single SPMD or pipeline run can start
+#define SPMD_MAX_CORES 64
+
+// default window of memory every core shares, everything else is private to each core
+#define SPMD_SHARED_BASE 0x8000
+#define SPMD_SHARED_WORDS 0x4000
+
+// forward declarations
+typedef struct Program Program;
+typedef struct VMOptions VMOptions;
+
+// BAR waits here until every core that is still running has reached it
+// cores that halt (or hit an error) leave, so the rest never wait on them
+typedef struct Barrier{
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+	size_t members;	// cores still running
+	size_t waiting;	// cores stuck at the current BAR
+	uint64_t generation;	// bumped every time the barrier opens
+} Barrier;
+
+void barrierWait(Barrier *barrier);
+void barrierLeave(Barrier *barrier);
+
+// runs options->cores copies of the program on their own threads and returns once every one has halted
+// returns -1 if any core stopped on an error
+int spmdRun(Program *program, const VMOptions *options);
+
+// runs each program as one stage of a pipeline on its own thread, stage i sends to stage i + 1 over a channel
+// the stages are numbered like cores so BAR and the core ports work the same
+int pipelineRun(Program **programs, const char **paths, size_t count, const VMOptions *options);
+
+#endif
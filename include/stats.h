@@ -0,0 +1,40 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "main.h"
+
+#include <stdint.h>
+
+#define STATS_OPCODES 64	// the opcode field is 6 bits wide
+#define STATS_NO_PREVIOUS STATS_OPCODES	// nothing has run yet so there is no bigram
+
+// taken and not taken counts for every conditional jump in one program, indexed by the jump's address
+typedef struct JumpStats{
+	char *source;
+	size_t codeLen;
+	uint32_t *lines;
+	uint64_t *taken;
+	uint64_t *notTaken;
+} JumpStats;
+
+// dynamic counters, a VM fills in its own while it runs and they get merged into a shared one afterwards
+typedef struct Stats{
+	uint64_t runs;
+	uint64_t instructions;
+	uint64_t stackHighWater;
+	uint64_t compileBytes;	// scratch memory the biggest compilation used, 0 when everything was already compiled
+	uint64_t opcodes[STATS_OPCODES];
+	uint64_t bigrams[STATS_OPCODES][STATS_OPCODES];	// [previous][current]
+	unsigned previous;	// last opcode recorded, only used while a VM is recording
+
+	JumpStats *programs;	// a VM has exactly one, the merged stats have one per distinct program
+	size_t programCount;
+} Stats;
+
+Stats *statsCreate(void);
+Stats *statsCreateRun(const char *source, const uint32_t *lines, size_t codeLen);
+void statsFree(Stats *stats);
+void statsMerge(Stats *into, const Stats *from);
+int statsWrite(const Stats *stats, const char *path);
+
+#endif
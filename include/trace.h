@@ -0,0 +1,63 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "main.h"
+
+#include <stdint.h>
+
+// magic at the start of a trace dump, followed by the format version
+#define TRACE_MAGIC "LXTR"
+#define TRACE_VERSION 1
+
+#define TRACE_DEFAULT_RECORDS (1u << 20)	// keeps the last ~1 million instructions (8 MiB)
+#define TRACE_DEFAULT_PATH "lexi.trace"
+
+// set in TraceRecord.flags when addr holds a memory address the instruction touched
+#define TRACE_HAS_ADDR 0x01
+
+// one executed instruction, kept to 8 bytes so recording is just a single store
+typedef struct TraceRecord{
+	uint16_t pc;	// address of the instruction word
+	uint8_t opcode;
+	uint8_t flags;
+	uint16_t acc;	// accumulator after the instruction ran
+	uint16_t addr;	// memory address touched, only valid with TRACE_HAS_ADDR
+} TraceRecord;
+
+// ring buffer of the most recent records, capacity is always a power of 2
+typedef struct Trace{
+	TraceRecord *records;
+	size_t mask;	// capacity - 1
+	uint64_t total;	// how many instructions have been recorded since the start
+	const char *sourcePath;	// written into the dump so the decoder can show source lines
+} Trace;
+
+// layout of a dump, all values in host byte order
+// header, source path, line table (codeLen entries), records oldest first
+typedef struct TraceHeader{
+	char magic[4];
+	uint32_t version;
+	uint64_t total;
+	uint32_t recordCount;
+	uint32_t codeLen;
+	uint32_t pathLen;
+	uint32_t reserved;
+} TraceHeader;
+
+Trace *traceCreate(size_t records, const char *sourcePath);
+void traceFree(Trace *trace);
+int traceDump(const Trace *trace, const uint32_t *lines, size_t codeLen, const char *path);
+const char *traceOpcodeName(unsigned opcode);
+
+// hot path, called once per instruction while tracing
+static inline void traceAppend(Trace *trace, uint16_t pc, uint8_t opcode, uint8_t flags, uint16_t acc, uint16_t addr){
+	TraceRecord *record = &trace->records[trace->total & trace->mask];
+	record->pc = pc;
+	record->opcode = opcode;
+	record->flags = flags;
+	record->acc = acc;
+	record->addr = addr;
+	trace->total++;
+}
+
+#endif
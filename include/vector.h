@@ -0,0 +1,18 @@
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include "main.h"
+
+// element wise dest[i] = dest[i] <op> src[i] for VADD VSUB VMUL VAND VXOR, wraps exactly like the scalar ALU ops
+void vectorApply(Opcode opcode, BITSIZE *dest, const BITSIZE *src, size_t len);
+
+// wrapping sum of every word in src, used by VSUM
+BITSIZE vectorSum(const BITSIZE *src, size_t len);
+
+// dest[i] = low byte of src[i], used to hand memory to the console in one write
+void vectorNarrow(uint8_t *dest, const BITSIZE *src, size_t len);
+
+// index of the first 0 word in src, len if there isn't one
+size_t vectorFindZero(const BITSIZE *src, size_t len);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "main.h"
+
+#include <stddef.h>
+
+// why verifyCode turned a program down, message is static text
+typedef struct VerifyError{
+	size_t pc;	// start of the instruction that failed
+	const char *message;
+} VerifyError;
+
+// how many words the instruction starting with word takes up, 0 if the opcode or operands don't make sense
+size_t verifyInstructionWords(BITSIZE word);
+
+// walks the code once before anything runs, every instruction has to decode, fit inside the code and
+// only name registers that exist, and every direct jump has to land on the start of an instruction
+// returns 0 and fills in error if something is wrong
+int verifyCode(const BITSIZE *code, size_t codeLen, VerifyError *error);
+
+// whether a jump to pc would be allowed in code that already passed verifyCode, the start of an instruction or the very end
+int verifyTarget(const BITSIZE *code, size_t codeLen, size_t pc);
+
+#endif
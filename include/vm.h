@@ -2,20 +2,117 @@
 #define VM_H
 
 #include "main.h"
+#include "device.h"
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// how many return addresses the shadow call stack remembers
+#define RETURN_STACK_SIZE 256
+
+// what CMP found out, the flag jumps test these
+#define FLAG_EQUAL 0x1
+#define FLAG_LESS 0x2	// signed
+#define FLAG_BELOW 0x4	// unsigned
 
 // forward declarations
-typedef struct Bytecode Bytecode;
+typedef struct Program Program;
+typedef struct DataRun DataRun;
+typedef struct Trace Trace;
+typedef struct Stats Stats;
+typedef struct Barrier Barrier;
+typedef struct Channel Channel;
+typedef struct Mapping Mapping;
+typedef struct Prerun Prerun;
+typedef struct Profile Profile;
+typedef struct ProfileSamples ProfileSamples;
+
+// settings for a single run, passing NULL to vmRun uses the defaults
+typedef struct VMOptions{
+	const char *sourcePath;	// only used to label diagnostics
+	size_t traceRecords;	// how many of the latest instructions to keep, 0 turns tracing off
+	const char *tracePath;	// where the trace gets dumped on exit or error
+	int perfCounters;	// report host performance counters around the run
+	Stats *stats;	// the run's dynamic counters get merged in here when the VM is destroyed, NULL turns them off
+	size_t cores;	// more than 1 runs that many copies of the program at once, see spmdRun
+	BITSIZE sharedBase;	// memory window every core sees, 0 words uses the default
+	size_t sharedWords;
+	const char *mapPath;	// file shown through a window of memory, NULL for none
+	BITSIZE mapBase;
+	size_t mapWords;
+	int mapReadOnly;	// otherwise writes go to a private copy
+	uint64_t instructionLimit;	// running more than this many instructions is a VM error, 0 for no limit
+	Profile *profile;	// sampled stacks get merged in here when the VM is destroyed, NULL turns sampling off
+} VMOptions;
 
 typedef struct VM{
-	Bytecode *bytecode;
+	Program *program;	// shared and read only, everything below belongs to this VM alone
+	const BITSIZE *code;	// normally the program's code, see vmAttachCode
+	const uint32_t *lines;
+	size_t codeLen;
 
 	BITSIZE registers[REG_ACC + 1];
-	BITSIZE memory[MAXSIZE];
+	uint8_t flags;	// FLAG_ bits from the last CMP
+	BITSIZE *memory;	// MAXSIZE words mapped lazily, untouched pages cost nothing and read as 0
+	Device devices[DEVICE_COUNT];	// handlers for the top page of memory
+	InputDevice input;
 	
 	size_t stackCount;
 	int running;
+	uint64_t instructionCount;	// instructions dispatched since the VM was created
+	uint64_t instructionLimit;	// the run stops once the count goes past this, either the budget or the end of a debugger step
+	uint64_t instructionBudget;	// UINT64_MAX when there's no budget
+	int debugging;	// the debugger's private code copy is attached, the only time BRK means anything
+	int paused;	// stopped on a BRK or at the end of a step, the PC is on the instruction that hasn't run yet
+	volatile BITSIZE samplePc;	// start of the instruction being run, for the sampling profiler to read at any moment
+
+	// shadow copy of the return addresses CALL has pushed, the real ones live on the stack in memory
+	// lets faster engines and tools know where a RET is going without reading memory
+	BITSIZE returnStack[RETURN_STACK_SIZE];
+	size_t returnDepth;
+
+	// execution trace, NULL unless enabled
+	Trace *trace;
+	const char *tracePath;
+
+	// dynamic counters for this VM alone and where they go when it's done, NULL unless enabled
+	Stats *stats;
+	Stats *statsSink;
+
+	// filled in by the profiler's signal handler and where it goes when it's done, NULL unless enabled
+	ProfileSamples *samples;
+	Profile *profileSink;
+
+	// which copy this is when running SPMD, a lone VM is core 0 of 1 and BAR does nothing
+	BITSIZE coreId;
+	BITSIZE coreCount;
+	Barrier *barrier;
+
+	// pipeline channels to the stages either side, NULL at the ends or outside of a pipeline
+	Channel *inbound;
+	Channel *outbound;
+
+	// host file shown in a window of memory, NULL unless enabled
+	Mapping *mapping;
+	BITSIZE readOnlyBase;	// writes here are errors, 0 words when nothing is read only
+	size_t readOnlyWords;
+
+	// set while running a program ahead of time at compile time, see prerunProgram
+	Prerun *prerun;
+
+	jmp_buf *errorJump;	// set while vmExecute is running so errors come back to it
 } VM;
 
-int vmRun(Bytecode *bytecode);
+int vmRun(Program *program, const VMOptions *options);
+
+VM *vmCreate(Program *program, const VMOptions *options);
+void vmAttachCode(VM *vm, const BITSIZE *code, const uint32_t *lines, size_t codeLen);
+int vmExecute(VM *vm);
+VM *vmActive(void);
+int vmLoadData(VM *vm, size_t address, const BITSIZE *words, size_t count);
+const DataRun *vmLoadProgramData(VM *vm, const Program *program);
+int vmMapWindow(VM *vm, BITSIZE base, size_t words, int fd, off_t offset, int prot, int flags);
+void vmDestroy(VM *vm);
 
 #endif
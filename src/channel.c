@@ -0,0 +1,198 @@
+#include "channel.h"
+
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define spinPause() __builtin_ia32_pause()
+#else
+#define spinPause() ((void)0)
+#endif
+
+// sleeps until the other side bumps signal
+// parked is set before watch is looked at again, and the other side sets watch before it looks at parked, so one of them always notices
+static void park(uint32_t *signal, uint32_t *parked, const uint32_t *watch, uint32_t seen, const uint32_t *gone){
+	uint32_t ticket = __atomic_load_n(signal, __ATOMIC_SEQ_CST);
+	__atomic_store_n(parked, 1, __ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(watch, __ATOMIC_SEQ_CST) == seen && !__atomic_load_n(gone, __ATOMIC_SEQ_CST)){
+		// returns straight away if signal already moved past ticket
+		syscall(SYS_futex, signal, FUTEX_WAIT_PRIVATE, ticket, NULL, NULL, 0);
+	}
+
+	__atomic_store_n(parked, 0, __ATOMIC_SEQ_CST);
+}
+
+// only pays for the syscall when the other side is actually asleep
+static void wake(uint32_t *signal, const uint32_t *parked){
+	if(__atomic_load_n(parked, __ATOMIC_SEQ_CST)){
+		__atomic_add_fetch(signal, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, signal, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+Channel *channelCreate(void){
+	// using malloc since channels are shared between threads and outlive any one VM
+	Channel *channel = aligned_alloc(CHANNEL_LINE, sizeof(Channel));
+	BITSIZE *slots = malloc(sizeof(BITSIZE) * CHANNEL_CAPACITY);
+	if(channel == NULL || slots == NULL){
+		fprintf(stderr, "Not enough memory for a channel.\n");
+		exit(74);
+	}
+
+	memset(channel, 0, sizeof(Channel));
+	channel->slots = slots;
+	channel->mask = CHANNEL_CAPACITY - 1;
+
+	return channel;
+}
+
+void channelFree(Channel *channel){
+	if(channel == NULL){
+		return;
+	}
+
+	free(channel->slots);
+	free(channel);
+}
+
+// lets the consumer see everything sent so far
+void channelFlush(Channel *channel){
+	if(channel->writeIndex == __atomic_load_n(&channel->head, __ATOMIC_RELAXED)){
+		return;	// nothing new
+	}
+
+	__atomic_store_n(&channel->head, channel->writeIndex, __ATOMIC_SEQ_CST);
+	wake(&channel->consumerSignal, &channel->consumerParked);
+}
+
+// gives the producer back every slot read so far
+static void channelRelease(Channel *channel){
+	if(channel->readIndex == __atomic_load_n(&channel->tail, __ATOMIC_RELAXED)){
+		return;
+	}
+
+	__atomic_store_n(&channel->tail, channel->readIndex, __ATOMIC_SEQ_CST);
+	wake(&channel->producerSignal, &channel->producerParked);
+}
+
+// waits for room, sends to a consumer that has already gone are dropped so the producer can't get stuck
+void channelSend(Channel *channel, BITSIZE value){
+	if(channel->writeIndex - channel->tailSeen == CHANNEL_CAPACITY){
+		for(unsigned spins = 0; ; spins++){
+			channel->tailSeen = __atomic_load_n(&channel->tail, __ATOMIC_ACQUIRE);
+			if(channel->writeIndex - channel->tailSeen != CHANNEL_CAPACITY){
+				break;
+			}
+			if(__atomic_load_n(&channel->abandoned, __ATOMIC_ACQUIRE)){
+				return;
+			}
+
+			if(spins < CHANNEL_SPINS){
+				spinPause();
+			}
+			else{
+				channelFlush(channel);	// the consumer has to see everything before we wait on it
+				park(&channel->producerSignal, &channel->producerParked, &channel->tail, channel->tailSeen, &channel->abandoned);
+			}
+		}
+	}
+
+	channel->slots[channel->writeIndex & channel->mask] = value;
+	channel->writeIndex++;
+
+	// hand over a whole line at a time unless the consumer is sitting there waiting
+	if((channel->writeIndex & (CHANNEL_BATCH - 1)) == 0 || __atomic_load_n(&channel->consumerParked, __ATOMIC_RELAXED)){
+		channelFlush(channel);
+	}
+}
+
+// the producer is done, whatever is still in the ring can be read before receives give CHANNEL_CLOSED
+void channelClose(Channel *channel){
+	channelFlush(channel);
+	__atomic_store_n(&channel->closed, 1, __ATOMIC_SEQ_CST);
+	wake(&channel->consumerSignal, &channel->consumerParked);
+}
+
+// takes the next word if one is already there
+int channelTryReceive(Channel *channel, BITSIZE *value){
+	if(channel->readIndex == channel->headSeen){
+		channel->headSeen = __atomic_load_n(&channel->head, __ATOMIC_ACQUIRE);
+		if(channel->readIndex == channel->headSeen){
+			return 0;
+		}
+	}
+
+	*value = channel->slots[channel->readIndex & channel->mask];
+	channel->readIndex++;
+
+	if((channel->readIndex & (CHANNEL_BATCH - 1)) == 0 || __atomic_load_n(&channel->producerParked, __ATOMIC_RELAXED)){
+		channelRelease(channel);
+	}
+
+	return 1;
+}
+
+// waits for the next word, returns 0 once the producer has closed the channel and it is empty
+int channelReceive(Channel *channel, BITSIZE *value){
+	for(unsigned spins = 0; ; spins++){
+		if(channelTryReceive(channel, value)){
+			return 1;
+		}
+
+		if(__atomic_load_n(&channel->closed, __ATOMIC_ACQUIRE)){
+			// closing happens after the last flush, so one more look catches anything sent right before it
+			return channelTryReceive(channel, value);
+		}
+
+		if(spins < CHANNEL_SPINS){
+			spinPause();
+		}
+		else{
+			channelRelease(channel);	// a producer waiting on room has to get it before we sleep
+			park(&channel->consumerSignal, &channel->consumerParked, &channel->head, channel->headSeen, &channel->closed);
+		}
+	}
+}
+
+// the consumer is done, from now on sends get dropped
+void channelAbandon(Channel *channel){
+	channelRelease(channel);
+	__atomic_store_n(&channel->abandoned, 1, __ATOMIC_SEQ_CST);
+	wake(&channel->producerSignal, &channel->producerParked);
+}
+
+// status port value for a VM, either channel may be NULL
+BITSIZE channelStatus(Channel *inbound, Channel *outbound){
+	BITSIZE status = 0;
+
+	if(inbound == NULL){
+		status |= CHANNEL_STATUS_CLOSED;
+	}
+	else{
+		if(inbound->readIndex == inbound->headSeen){
+			inbound->headSeen = __atomic_load_n(&inbound->head, __ATOMIC_ACQUIRE);
+		}
+		if(inbound->readIndex != inbound->headSeen){
+			status |= CHANNEL_STATUS_READY;
+		}
+		else if(__atomic_load_n(&inbound->closed, __ATOMIC_ACQUIRE) && __atomic_load_n(&inbound->head, __ATOMIC_ACQUIRE) == inbound->readIndex){
+			status |= CHANNEL_STATUS_CLOSED;
+		}
+	}
+
+	if(outbound != NULL){
+		if(outbound->writeIndex - outbound->tailSeen == CHANNEL_CAPACITY){
+			outbound->tailSeen = __atomic_load_n(&outbound->tail, __ATOMIC_ACQUIRE);
+		}
+		if(outbound->writeIndex - outbound->tailSeen == CHANNEL_CAPACITY && !__atomic_load_n(&outbound->abandoned, __ATOMIC_ACQUIRE)){
+			status |= CHANNEL_STATUS_FULL;
+		}
+	}
+
+	return status;
+}
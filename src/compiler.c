@@ -1,8 +1,11 @@
 #include "compiler.h"
+#include "device.h"
 #include "main.h"
 #include "parser.h"
+#include "scratch.h"
 
 #include <ctype.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -15,31 +18,8 @@
 #define DEST_SHIFT 5
 #define FIELD_MASK 0x1F
 
-// table and entry for storing labels while compiling
-typedef struct{
-	char *name;
-	size_t address;
-	size_t line;
-} LabelEntry;
-
-typedef struct{
-	LabelEntry *items;
-	size_t count;
-	size_t capacity;
-} LabelTable;
-
-// table and entry for storing patches while compiling
-typedef struct{
-	char *name;
-	size_t index;
-	size_t line;
-} PatchEntry;
-
-typedef struct{
-	PatchEntry *items;
-	size_t count;
-	size_t capacity;
-} PatchTable;
+// where compilerError goes instead of exiting while assemblerFeed is running
+static jmp_buf *recoverPoint = NULL;
 
 // for reporting compiling errors takes in list of arguements at end for string formatting
 static void compilerError(size_t line, const char *fmt, ...){
@@ -52,8 +32,11 @@ static void compilerError(size_t line, const char *fmt, ...){
 	vfprintf(stderr, fmt, args);
 	fputs("\n", stderr);
 
-	// cleanup and exit
+	// cleanup and exit, or just abandon the line if someone can recover
 	va_end(args);
+	if(recoverPoint != NULL){
+		longjmp(*recoverPoint, 1);
+	}
 	exit(66);
 }
 
@@ -69,15 +52,8 @@ static void ensureLabelCapacity(LabelTable *table, size_t needed){
 		newCapacity *= 2;
 	}
 
-	// copy over values from old one to new one
-	LabelEntry *oldItems = table->items;
-	LabelEntry *newItems = gcAlloc(sizeof(LabelEntry) * newCapacity);
-	if(oldItems != NULL && table->count > 0){
-		memcpy(newItems, oldItems, table->count * sizeof(LabelEntry));
-	}
-
-	// assign values
-	table->items = newItems;
+	// grows in place when nothing was allocated since, otherwise the entries get copied over
+	table->items = scratchGrow(table->items, sizeof(LabelEntry) * table->capacity, sizeof(LabelEntry) * newCapacity);
 	table->capacity = newCapacity;
 }
 
@@ -93,22 +69,15 @@ static void ensurePatchCapacity(PatchTable *table, size_t needed){
 		newCapacity *= 2;
 	}
 
-	// copy over values into a new array
-	PatchEntry *oldItems = table->items;
-	PatchEntry *newItems = gcAlloc(sizeof(PatchEntry) * newCapacity);
-	if(oldItems != NULL && table->count > 0){
-		memcpy(newItems, oldItems, table->count * sizeof(PatchEntry));
-	}
-
-	// assign values
-	table->items = newItems;
+	// same as the label table
+	table->items = scratchGrow(table->items, sizeof(PatchEntry) * table->capacity, sizeof(PatchEntry) * newCapacity);
 	table->capacity = newCapacity;
 }
 
 // copies a char array as all uppercase
 static char *uppercaseCopy(const char *lexeme, size_t start, size_t end){
 	size_t len = end > start ? end - start : 0;	// check bounds are valid
-	char *result = gcAlloc(len + 1);	// allocate a result array
+	char *result = scratchAlloc(len + 1);	// allocate a result array
 
 	// copy over the values in the array as uppercase
 	for(size_t i = 0; i < len; i++){
@@ -142,7 +111,7 @@ static char *copyLabelName(const Token *token, int isDefinition){
 }
 
 // adds a label to the table
-static void addLabel(LabelTable *table, char *name, size_t address, size_t line){
+static void addLabel(LabelTable *table, char *name, size_t address, size_t line, LabelKind kind){
 	for(size_t i = 0; i < table->count; i++){	// for every stored label
 		if(strcmp(table->items[i].name, name) == 0){	// if the label is the same as the one we want to make
 			compilerError(line, "Duplicate label '%s'", name);	// can't have duplicates
@@ -156,33 +125,46 @@ static void addLabel(LabelTable *table, char *name, size_t address, size_t line)
 	table->items[table->count].name = name;
 	table->items[table->count].address = address;
 	table->items[table->count].line = line;
+	table->items[table->count].kind = kind;
 
 	table->count++;
 }
 
-// finds a label in the table
-static int findLabel(const LabelTable *table, const char *name, size_t *addressOut){
+// finds a label in the table, NULL if it hasn't been declared
+static const LabelEntry *findLabel(const LabelTable *table, const char *name){
 	for(size_t i = 0; i < table->count; i++){	// for every label
 		if(strcmp(table->items[i].name, name) == 0){	// if the label is the one we are looking for
-			if(addressOut != NULL){	// if we want to return the address to be used by caller
-				*addressOut = table->items[i].address;
-			}
-
-			return 1;	// true
+			return &table->items[i];
 		}
 	}
 
-	return 0;	// false
+	return NULL;
+}
+
+// gives the address of a label for a reference, jumping into data or loading from code is always a mistake
+static size_t labelAddress(const LabelEntry *label, LabelKind kind, size_t line){
+	if(kind == LABEL_CODE && label->kind != LABEL_CODE){
+		compilerError(line, "Label '%s' marks data, it can't be jumped to", label->name);
+	}
+	if(kind == LABEL_DATA && label->kind != LABEL_DATA){
+		compilerError(line, "Label '%s' marks code, it has no memory address", label->name);
+	}
+	if(label->address >= MAXSIZE){	// if the address is out of range
+		compilerError(line, "Label '%s' address out of range", label->name);
+	}
+
+	return label->address;
 }
 
 // stores a patch in the table
-static void recordPatch(PatchTable *patches, char *name, size_t index, size_t line){
+static void recordPatch(PatchTable *patches, char *name, size_t index, size_t line, LabelKind kind){
 	ensurePatchCapacity(patches, patches->count + 1);	// make sure we have the space
 
 	// assign values
 	patches->items[patches->count].name = name;
 	patches->items[patches->count].index = index;
 	patches->items[patches->count].line = line;
+	patches->items[patches->count].kind = kind;
 
 	patches->count++;
 }
@@ -267,7 +249,7 @@ static uint16_t parseAddress(const Token *token){
 	}
 
 	// copy the value inside the []
-	char *copy = gcAlloc(token->len - 1);
+	char *copy = scratchAlloc(token->len - 1);
 	memcpy(copy, lexeme + 1, token->len - 2);
 	copy[token->len - 2] = '\0';
 	char *endptr = NULL;
@@ -328,27 +310,266 @@ static Opcode parseOpcode(const Token *token){
 	if(strcmp(buffer, "PRN") == 0) return OP_PRN;
 	if(strcmp(buffer, "HLT") == 0) return OP_HLT;
 	if(strcmp(buffer, "NOP") == 0) return OP_NOP;
+	if(strcmp(buffer, "VADD") == 0) return OP_VADD;
+	if(strcmp(buffer, "VSUB") == 0) return OP_VSUB;
+	if(strcmp(buffer, "VMUL") == 0) return OP_VMUL;
+	if(strcmp(buffer, "VAND") == 0) return OP_VAND;
+	if(strcmp(buffer, "VXOR") == 0) return OP_VXOR;
+	if(strcmp(buffer, "VSUM") == 0) return OP_VSUM;
+	if(strcmp(buffer, "CALL") == 0) return OP_CALL;
+	if(strcmp(buffer, "RET") == 0) return OP_RET;
+	if(strcmp(buffer, "RDS") == 0) return OP_RDS;
+	if(strcmp(buffer, "XCHG") == 0) return OP_XCHG;
+	if(strcmp(buffer, "CAS") == 0) return OP_CAS;
+	if(strcmp(buffer, "FADD") == 0) return OP_FADD;
+	if(strcmp(buffer, "BAR") == 0) return OP_BAR;
+	if(strcmp(buffer, "PRS") == 0) return OP_PRS;
+	if(strcmp(buffer, "PRZ") == 0) return OP_PRZ;
+	if(strcmp(buffer, "MOD") == 0) return OP_MOD;
+	if(strcmp(buffer, "SHL") == 0) return OP_SHL;
+	if(strcmp(buffer, "SHR") == 0) return OP_SHR;
+	if(strcmp(buffer, "SAR") == 0) return OP_SAR;
+	if(strcmp(buffer, "ROL") == 0) return OP_ROL;
+	if(strcmp(buffer, "CMP") == 0) return OP_CMP;
+	if(strcmp(buffer, "JEQ") == 0) return OP_JEQ;
+	if(strcmp(buffer, "JNE") == 0) return OP_JNE;
+	if(strcmp(buffer, "JLT") == 0) return OP_JLT;
+	if(strcmp(buffer, "JGE") == 0) return OP_JGE;
+	if(strcmp(buffer, "JLTU") == 0) return OP_JLTU;
+	if(strcmp(buffer, "JGEU") == 0) return OP_JGEU;
 
 	// shouldn't get here
 	compilerError(token->line, "Unknown opcode '%s'", token->start);
 	return OP_NOP;
 }
 
+// makes sure the bytecode has room for a needed amount of words
+static void ensureCodeCapacity(Bytecode *bytecode, size_t needed){
+	if(bytecode->capacity >= needed){
+		return;	// already big enough
+	}
+
+	// calculate the new size with a base of 64, never past what the PC can reach
+	size_t newCapacity = bytecode->capacity == 0 ? 64 : bytecode->capacity * 2;
+	while(newCapacity < needed){
+		newCapacity *= 2;
+	}
+	if(newCapacity > bytecode->maxSize){
+		newCapacity = bytecode->maxSize;
+	}
+
+	// copy over values into new arrays
+	bytecode->code = scratchGrow(bytecode->code, sizeof(BITSIZE) * bytecode->capacity, sizeof(BITSIZE) * newCapacity);
+	bytecode->lines = scratchGrow(bytecode->lines, sizeof(uint32_t) * bytecode->capacity, sizeof(uint32_t) * newCapacity);
+	bytecode->capacity = newCapacity;
+}
+
 // emits a word into bytecode
 static void emitWord(Bytecode *bytecode, uint16_t value){
-	if(bytecode->codeLen >= MAXSIZE){	// must be within size accessable by PC
+	if(bytecode->codeLen >= bytecode->maxSize){	// must be within size accessable by PC
 		fprintf(stderr, "[Compiler]: Bytecode size exceeds maximum of %d words\n", MAXSIZE);
 		exit(67);
 	}
 
+	ensureCodeCapacity(bytecode, bytecode->codeLen + 1);
 	bytecode->code[bytecode->codeLen++] = value;
 }
 
+// emits the address of a label, ones that aren't declared yet (or every one in an object) are left as patches
+static void emitLabelReference(Assembler *assembler, char *name, LabelKind kind, size_t line){
+	Bytecode *bytecode = assembler->bytecode;
+	const LabelEntry *label = assembler->relocatable ? NULL : findLabel(&assembler->labels, name);
+	if(label != NULL){
+		emitWord(bytecode,(uint16_t)labelAddress(label, kind, line));
+		return;
+	}
+
+	recordPatch(&assembler->patches, name, bytecode->codeLen, line, kind);
+	emitWord(bytecode, 0);
+}
+
+// label names start with a letter or underscore, numbers never do
+static int startsLabel(char ch){
+	return isalpha((unsigned char)ch) || ch == '_';
+}
+
+// emits a memory address operand, either a number or a data label between the brackets
+static void emitAddress(Assembler *assembler, const Token *token){
+	if(token->len > 2 && startsLabel(token->start[1])){
+		emitLabelReference(assembler, uppercaseCopy(token->start, 1, token->len - 1), LABEL_DATA, token->line);
+		return;
+	}
+
+	emitWord(assembler->bytecode, parseAddress(token));
+}
+
+// emits the word after an instruction for a #value operand, either a number or the address of any label
+static void emitImmediate(Assembler *assembler, const Token *token){
+	if(startsLabel(token->start[1])){
+		emitLabelReference(assembler, uppercaseCopy(token->start, 1, token->len), LABEL_ANY, token->line);
+		return;
+	}
+
+	emitWord(assembler->bytecode,(uint16_t)(parseImmediate(token) & 0xFFFF));
+}
+
+// makes sure the data image reaches end, it is indexed by address so it only ever grows upwards
+static void ensureDataCapacity(Bytecode *bytecode, size_t end){
+	if(bytecode->dataCapacity >= end){
+		return;
+	}
+
+	size_t newCapacity = bytecode->dataCapacity == 0 ? 64 : bytecode->dataCapacity * 2;
+	while(newCapacity < end){
+		newCapacity *= 2;
+	}
+	if(newCapacity > DEVICE_BASE){
+		newCapacity = DEVICE_BASE;	// data never goes in the device page
+	}
+
+	// the gaps between .org blocks stay 0, the same as untouched memory
+	bytecode->data = scratchGrow(bytecode->data, sizeof(BITSIZE) * bytecode->dataCapacity, sizeof(BITSIZE) * newCapacity);
+	memset(bytecode->data + bytecode->dataCapacity, 0, sizeof(BITSIZE) * (newCapacity - bytecode->dataCapacity));
+	bytecode->dataCapacity = newCapacity;
+}
+
+// writes words into the data image at address and widens the written range to cover them
+void assemblerPlaceData(Assembler *assembler, size_t address, const BITSIZE *words, size_t count, size_t line){
+	if(count == 0){
+		return;
+	}
+	if(address + count > DEVICE_BASE){
+		compilerError(line, "Data at 0x%04zX + %zu words runs into the device page", address, count);
+	}
+
+	Bytecode *bytecode = assembler->bytecode;
+	ensureDataCapacity(bytecode, address + count);
+	memcpy(bytecode->data + address, words, sizeof(BITSIZE) * count);
+
+	if(bytecode->dataEnd == bytecode->dataBase){	// first data there is
+		bytecode->dataBase = address;
+		bytecode->dataEnd = address + count;
+	}
+	else{
+		bytecode->dataBase = address < bytecode->dataBase ? address : bytecode->dataBase;
+		bytecode->dataEnd = address + count > bytecode->dataEnd ? address + count : bytecode->dataEnd;
+	}
+
+	if(assembler->fedDataEnd == assembler->fedDataBase){
+		assembler->fedDataBase = address;
+		assembler->fedDataEnd = address + count;
+	}
+	else{
+		assembler->fedDataBase = address < assembler->fedDataBase ? address : assembler->fedDataBase;
+		assembler->fedDataEnd = address + count > assembler->fedDataEnd ? address + count : assembler->fedDataEnd;
+	}
+}
+
+// turns the inside of a string token into words, one character each, with a 0 word on the end
+static BITSIZE *decodeString(const Token *token, size_t *countOut){
+	BITSIZE *words = scratchAlloc(sizeof(BITSIZE) * token->len);	// the quotes alone leave room for the terminator
+	size_t count = 0;
+	for(size_t i = 1; i + 1 < token->len; i++){
+		char ch = token->start[i];
+		if(ch == '\\'){
+			i++;
+			switch(token->start[i]){
+				case 'n': ch = '\n'; break;
+				case 't': ch = '\t'; break;
+				case 'r': ch = '\r'; break;
+				case '0': ch = '\0'; break;
+				case '\\': ch = '\\'; break;
+				case '"': ch = '"'; break;
+				default:
+					compilerError(token->line, "Unknown escape '\\%c' in string", token->start[i]);
+			}
+		}
+		words[count++] = (BITSIZE)(unsigned char)ch;
+	}
+	words[count++] = 0;
+
+	*countOut = count;
+	return words;
+}
+
+// .org only moves the cursor, the labels in front of it belong to whatever comes after
+static int isOrigin(const Token *directive){
+	return strcmp(uppercaseCopy(directive->start, 0, directive->len), ".ORG") == 0;
+}
+
+// lays out data for one directive line, operands is every token after the directive on that line
+// every operand is checked before anything is written so a bad line leaves the data alone
+static void compileDirective(const Token *directive, Token *operands, size_t operandCount, Assembler *assembler){
+	char *name = uppercaseCopy(directive->start, 0, directive->len);
+	size_t line = directive->line;
+
+	if(strcmp(name, ".ORG") == 0){
+		if(operandCount != 1 || operands[0].type != TOKEN_IMMD){
+			compilerError(line, ".org syntax is '.org <address>'");
+		}
+		int32_t address = parseImmediate(&operands[0]);
+		if(address < 0 || address >= DEVICE_BASE){
+			compilerError(line, ".org address must be below the device page");
+		}
+		assembler->dataCursor = (size_t)address;
+		assembler->dataFixed = 1;
+	}
+	else if(strcmp(name, ".WORD") == 0){
+		if(operandCount == 0){
+			compilerError(line, ".word expects at least 1 value");
+		}
+
+		BITSIZE *words = scratchAlloc(sizeof(BITSIZE) * operandCount);
+		for(size_t i = 0; i < operandCount; i++){
+			if(operands[i].type != TOKEN_IMMD){
+				compilerError(line, ".word values must be numbers");
+			}
+			words[i] = (BITSIZE)(parseImmediate(&operands[i]) & 0xFFFF);
+		}
+		assemblerPlaceData(assembler, assembler->dataCursor, words, operandCount, line);
+		assembler->dataCursor += operandCount;
+	}
+	else if(strcmp(name, ".FILL") == 0){
+		if(operandCount < 1 || operandCount > 2 || operands[0].type != TOKEN_IMMD || (operandCount == 2 && operands[1].type != TOKEN_IMMD)){
+			compilerError(line, ".fill syntax is '.fill <count>[, value]'");
+		}
+
+		int32_t count = parseImmediate(&operands[0]);
+		if(count < 0 || count > DEVICE_BASE){
+			compilerError(line, ".fill count out of range");
+		}
+		BITSIZE value = operandCount == 2 ? (BITSIZE)(parseImmediate(&operands[1]) & 0xFFFF) : 0;
+
+		BITSIZE *words = scratchAlloc(sizeof(BITSIZE) * ((size_t)count + 1));
+		for(int32_t i = 0; i < count; i++){
+			words[i] = value;
+		}
+		assemblerPlaceData(assembler, assembler->dataCursor, words, (size_t)count, line);
+		assembler->dataCursor += (size_t)count;
+	}
+	else if(strcmp(name, ".STRING") == 0){
+		if(operandCount != 1 || operands[0].type != TOKEN_STRING){
+			compilerError(line, ".string syntax is '.string \"text\"'");
+		}
+
+		size_t count = 0;
+		BITSIZE *words = decodeString(&operands[0], &count);
+		assemblerPlaceData(assembler, assembler->dataCursor, words, count, line);
+		assembler->dataCursor += count;
+	}
+	else{
+		compilerError(line, "Unknown directive '%s'", directive->start);
+	}
+}
+
 // compiles a word based on a token
-static void compileInstruction(const Token *opToken, Token **operands, size_t operandCount, Bytecode *bytecode, PatchTable *patches, const LabelTable *labels){
+static void compileInstruction(const Token *opToken, Token **operands, size_t operandCount, Assembler *assembler){
+	Bytecode *bytecode = assembler->bytecode;
+
 	// get the opcode and line
 	Opcode opcode = parseOpcode(opToken);
 	size_t line = opToken->line;
+	size_t start = bytecode->codeLen;	// first word this instruction emits
 
 	// execute based on opcode
 	switch(opcode){
@@ -365,10 +586,9 @@ static void compileInstruction(const Token *opToken, Token **operands, size_t op
 				int srcReg = parseRegister(operands[1]);
 				emitWord(bytecode,(uint16_t)encodeWord(opcode, destReg, srcReg));
 			}
-			else if(operands[1]->type == TOKEN_IMMD){
-				int32_t value = parseImmediate(operands[1]);
+			else if(operands[1]->type == TOKEN_IMMD){	// a number or #label, code or data
 				emitWord(bytecode,(uint16_t)encodeWord(opcode, destReg, OPERAND_IMMEDIATE));
-				emitWord(bytecode,(uint16_t)(value & 0xFFFF));
+				emitImmediate(assembler, operands[1]);
 			}
 			else{
 				compilerError(operands[1]->line, "MOV source must be register or immediate");
@@ -376,6 +596,28 @@ static void compileInstruction(const Token *opToken, Token **operands, size_t op
 
 			break;
 		}
+		case OP_CMP:{
+			if(operandCount != 2){
+				compilerError(line, "CMP expects 2 operands");
+			}
+			if(operands[0]->type != TOKEN_REG){
+				compilerError(operands[0]->line, "CMP syntax is 'CMP <reg>, <reg>|#imm'");
+			}
+
+			int leftReg = parseRegister(operands[0]);
+			if(operands[1]->type == TOKEN_REG){
+				emitWord(bytecode,(uint16_t)encodeWord(opcode, leftReg, parseRegister(operands[1])));
+			}
+			else if(operands[1]->type == TOKEN_IMMD){
+				emitWord(bytecode,(uint16_t)encodeWord(opcode, leftReg, OPERAND_IMMEDIATE));
+				emitImmediate(assembler, operands[1]);
+			}
+			else{
+				compilerError(operands[1]->line, "CMP syntax is 'CMP <reg>, <reg>|#imm'");
+			}
+
+			break;
+		}
 		case OP_LD:{
 			if(operandCount != 2){
 				compilerError(line, "LD expects 2 operands");
@@ -385,9 +627,8 @@ static void compileInstruction(const Token *opToken, Token **operands, size_t op
 			}
 
 			int destReg = parseRegister(operands[0]);
-			uint16_t addr = parseAddress(operands[1]);
 			emitWord(bytecode,(uint16_t)encodeWord(opcode, destReg, OPERAND_IMMEDIATE));
-			emitWord(bytecode, addr);
+			emitAddress(assembler, operands[1]);
 
 			break;
 		}
@@ -400,22 +641,45 @@ static void compileInstruction(const Token *opToken, Token **operands, size_t op
 			}
 
 			int srcReg = parseRegister(operands[0]);
-			uint16_t addr = parseAddress(operands[1]);
 			emitWord(bytecode,(uint16_t)encodeWord(opcode, srcReg, OPERAND_IMMEDIATE));
-			emitWord(bytecode, addr);
+			emitAddress(assembler, operands[1]);
 
 			break;
 		}
-		case OP_PUSH:
-		case OP_POP:
 		case OP_ADD:
 		case OP_SUB:
 		case OP_MUL:
 		case OP_DIV:
+		case OP_MOD:
 		case OP_AND:
 		case OP_OR:
 		case OP_XOR:
-		case OP_PRN:{
+		case OP_SHL:
+		case OP_SHR:
+		case OP_SAR:
+		case OP_ROL:{
+			if(operandCount != 1){
+				compilerError(line, "Instruction expects 1 operand");
+			}
+
+			// the immediate form leaves the register field empty and puts the value in the next word
+			if(operands[0]->type == TOKEN_REG){
+				emitWord(bytecode,(uint16_t)encodeWord(opcode, parseRegister(operands[0]), OPERAND_NONE));
+			}
+			else if(operands[0]->type == TOKEN_IMMD){
+				emitWord(bytecode,(uint16_t)encodeWord(opcode, OPERAND_NONE, OPERAND_IMMEDIATE));
+				emitImmediate(assembler, operands[0]);
+			}
+			else{
+				compilerError(operands[0]->line, "Operand must be a register or immediate");
+			}
+
+			break;
+		}
+		case OP_PUSH:
+		case OP_POP:
+		case OP_PRN:
+		case OP_PRZ:{
 			if(operandCount != 1){
 				compilerError(line, "Instruction expects 1 operand");
 			}
@@ -436,7 +700,9 @@ static void compileInstruction(const Token *opToken, Token **operands, size_t op
 		case OP_CLR:
 		case OP_NOT:
 		case OP_HLT:
-		case OP_NOP:{
+		case OP_NOP:
+		case OP_RET:
+		case OP_BAR:{
 			if(operandCount != 0){
 				compilerError(line, "Instruction does not take operands");
 			}
@@ -448,7 +714,14 @@ static void compileInstruction(const Token *opToken, Token **operands, size_t op
 		case OP_JMP:
 		case OP_JEZ:
 		case OP_JLZ:
-		case OP_JGZ:{
+		case OP_JGZ:
+		case OP_JEQ:
+		case OP_JNE:
+		case OP_JLT:
+		case OP_JGE:
+		case OP_JLTU:
+		case OP_JGEU:
+		case OP_CALL:{
 			if(operandCount != 1){
 				compilerError(line, "Jump instruction expects 1 operand");
 			}
@@ -456,53 +729,135 @@ static void compileInstruction(const Token *opToken, Token **operands, size_t op
 				compilerError(operands[0]->line, "Jump target must be a label");
 			}
 
+			// backwards jumps can be filled in right away, forward ones wait for the label
+			// objects leave every jump to the linker since their code moves when it gets placed
 			char *labelName = copyLabelName(operands[0], 0);
 			emitWord(bytecode,(uint16_t)encodeWord(opcode, OPERAND_IMMEDIATE, OPERAND_NONE));
-			size_t patchIndex = bytecode->codeLen;
-			emitWord(bytecode, 0);
+			emitLabelReference(assembler, labelName, LABEL_CODE, operands[0]->line);
+
+			break;
+		}
+		case OP_VADD:
+		case OP_VSUB:
+		case OP_VMUL:
+		case OP_VAND:
+		case OP_VXOR:{
+			if(operandCount != 3){
+				compilerError(line, "Vector instruction expects 3 operands");
+			}
+			if(operands[0]->type != TOKEN_REG || operands[1]->type != TOKEN_REG || operands[2]->type != TOKEN_REG){
+				compilerError(line, "Vector syntax is '<op> <dest_reg>, <src_reg>, <len_reg>'");
+			}
 
-			recordPatch(patches, labelName, patchIndex, operands[0]->line);
+			// the length register doesn't fit in the first word so it gets its own
+			int destReg = parseRegister(operands[0]);
+			int srcReg = parseRegister(operands[1]);
+			int lenReg = parseRegister(operands[2]);
+			emitWord(bytecode,(uint16_t)encodeWord(opcode, destReg, srcReg));
+			emitWord(bytecode,(uint16_t)lenReg);
+
+			break;
+		}
+		case OP_VSUM:
+		case OP_RDS:
+		case OP_PRS:{
+			if(operandCount != 2){
+				compilerError(line, "Instruction expects 2 operands");
+			}
+			if(operands[0]->type != TOKEN_REG || operands[1]->type != TOKEN_REG){
+				compilerError(line, "Syntax is '<op> <addr_reg>, <len_reg>'");
+			}
+
+			int srcReg = parseRegister(operands[0]);
+			int lenReg = parseRegister(operands[1]);
+			emitWord(bytecode,(uint16_t)encodeWord(opcode, srcReg, lenReg));
+
+			break;
+		}
+		case OP_XCHG:
+		case OP_CAS:
+		case OP_FADD:{
+			if(operandCount != 2){
+				compilerError(line, "Atomic instruction expects 2 operands");
+			}
+			if(operands[0]->type != TOKEN_REG || operands[1]->type != TOKEN_REG){
+				compilerError(line, "Atomic syntax is '<op> <reg>, <addr_reg>'");
+			}
+
+			int reg = parseRegister(operands[0]);
+			int addrReg = parseRegister(operands[1]);
+			emitWord(bytecode,(uint16_t)encodeWord(opcode, reg, addrReg));
 
 			break;
 		}
 		default:
 			compilerError(line, "Unhandled opcode");
 	}
-	(void)labels;	// currently not used directly inside switch
+
+	// every word of the instruction maps back to its source line
+	for(size_t i = start; i < bytecode->codeLen; i++){
+		bytecode->lines[i] = (uint32_t)line;
+	}
 }
 
-// 
-static void patchLabels(Bytecode *bytecode, const LabelTable *labels, const PatchTable *patches){
-	for(size_t i = 0; i < patches->count; i++){	// for every patch
-		const PatchEntry *patch = &patches->items[i];
-		size_t address = 0;
+// looks for name among the labels from first onwards
+static const LabelEntry *findNewLabel(const LabelTable *labels, size_t first, const char *name){
+	for(size_t i = first; i < labels->count; i++){
+		if(strcmp(labels->items[i].name, name) == 0){
+			return &labels->items[i];
+		}
+	}
+
+	return NULL;
+}
 
-		if(!findLabel(labels, patch->name, &address)){	// if we can't find a label for the patch
-			compilerError(patch->line, "Undefined label '%s'", patch->name);
+// fills in pending patches that refer to labels declared from firstLabel onwards
+static void resolvePatches(Assembler *assembler, size_t firstLabel){
+	LabelTable *labels = &assembler->labels;
+	PatchTable *patches = &assembler->patches;
+	if(firstLabel >= labels->count){
+		return;	// no new labels so nothing can have been resolved
+	}
+
+	// every patch is checked before the table is touched, an error part way through would leave it half compacted
+	for(size_t i = 0; i < patches->count; i++){
+		const LabelEntry *label = findNewLabel(labels, firstLabel, patches->items[i].name);
+		if(label != NULL){
+			labelAddress(label, patches->items[i].kind, patches->items[i].line);
 		}
-		if(address >= MAXSIZE){	// if the address is out of range
-			compilerError(patch->line, "Label '%s' address out of range", patch->name);
+	}
+
+	// only the new labels are searched, patches that are still pending keep their order
+	size_t kept = 0;
+	for(size_t i = 0; i < patches->count; i++){	// for every patch
+		PatchEntry *patch = &patches->items[i];
+		const LabelEntry *label = findNewLabel(labels, firstLabel, patch->name);
+		if(label == NULL){	// still waiting on its label
+			patches->items[kept++] = *patch;
+			continue;
 		}
 
 		// insert the address into bytecode
-		bytecode->code[patch->index] = (uint16_t)address;
+		assembler->bytecode->code[patch->index] = (uint16_t)labelAddress(label, patch->kind, patch->line);
 	}
+	patches->count = kept;
 }
 
-// main compiler function compiles bytecode based off of a stream of tokens
-Bytecode *compiler(Token *tokens){
-	if(tokens == NULL){
-		return NULL;	// need to have tokens to compile
+// declares the labels waiting in tokens[first] onwards at address
+static void bindLabels(Assembler *assembler, const Token *tokens, size_t first, size_t count, size_t address, LabelKind kind){
+	for(size_t i = first; i < first + count; i++){
+		char *labelName = copyLabelName(&tokens[i], 1);
+		addLabel(&assembler->labels, labelName, address, tokens[i].line, kind);
 	}
+}
 
-	// initialize bytecode
-	Bytecode *bytecode = gcAlloc(sizeof(Bytecode));
-	bytecode->codeLen = 0;
-	bytecode->maxSize = MAXSIZE;
-
-	// make empty label and patches
-	LabelTable labels = {0};
-	PatchTable patches = {0};
+// compiles a stream of tokens onto the end of the assembler's bytecode
+// forward jumps are left in the patch table for the caller to resolve once the tokens are all in
+static void assembleTokens(Assembler *assembler, Token *tokens){
+	// labels mark whatever comes next, an instruction or data, so they wait until it shows up
+	// only label lines can sit between them and it, so the waiting ones are always next to each other
+	size_t pendingFirst = 0;
+	size_t pendingCount = 0;
 
 	// while we have tokens until the TOKEN_END
 	size_t index = 0;
@@ -511,23 +866,45 @@ Bytecode *compiler(Token *tokens){
 
 		// handle label declarations that start the line
 		while(tokens[index].type == TOKEN_LABEL && tokens[index].start[0] == '@' && tokens[index].line == line){
-			char *labelName = copyLabelName(&tokens[index], 1);
-			addLabel(&labels, labelName, bytecode->codeLen, tokens[index].line);
+			if(pendingCount == 0){
+				pendingFirst = index;
+			}
+			pendingCount++;
 			index++;
 
 			if(tokens[index].type == TOKEN_END){
 				break;	// we reached the end
 			}
 		}
+
 		if(tokens[index].type == TOKEN_END){
 			break;	// reached the end
 		}
 		if(tokens[index].line != line){
 			continue;	// if we aren't on the right line move onto next loop iteration
 		}
+
+		if(tokens[index].type == TOKEN_DIRECTIVE){	// data, takes every token left on the line
+			Token *directive = &tokens[index];
+			index++;
+			size_t operandStart = index;
+			while(tokens[index].type != TOKEN_END && tokens[index].line == line){
+				index++;
+			}
+
+			if(!isOrigin(directive)){
+				bindLabels(assembler, tokens, pendingFirst, pendingCount, assembler->dataCursor, LABEL_DATA);
+				pendingCount = 0;
+			}
+			compileDirective(directive, &tokens[operandStart], index - operandStart, assembler);
+			continue;
+		}
+
 		if(tokens[index].type != TOKEN_OP){
 			compilerError(tokens[index].line, "Unexpected token '%s'", tokens[index].start);
 		}
+		bindLabels(assembler, tokens, pendingFirst, pendingCount, assembler->bytecode->codeLen, LABEL_CODE);
+		pendingCount = 0;
 		Token *opToken = &tokens[index];
 		index++;
 
@@ -543,12 +920,148 @@ Bytecode *compiler(Token *tokens){
 		}
 
 		// compile the instruction
-		compileInstruction(opToken, operands, operandCount, bytecode, &patches, &labels);
+		compileInstruction(opToken, operands, operandCount, assembler);
 	}
 
+	// labels at the very end mark the end of the code
+	bindLabels(assembler, tokens, pendingFirst, pendingCount, assembler->bytecode->codeLen, LABEL_CODE);
+}
+
+// makes an assembler with empty bytecode, labels and patches
+Assembler *assemblerCreate(void){
+	Assembler *assembler = scratchAlloc(sizeof(Assembler));
+
+	// initialize bytecode
+	Bytecode *bytecode = scratchAlloc(sizeof(Bytecode));
+	bytecode->code = NULL;
+	bytecode->lines = NULL;
+	bytecode->codeLen = 0;
+	bytecode->capacity = 0;
+	bytecode->maxSize = MAXSIZE;
+	bytecode->data = NULL;
+	bytecode->dataBase = 0;
+	bytecode->dataEnd = 0;
+	bytecode->dataCapacity = 0;
+
+	// make empty label and patches
+	assembler->bytecode = bytecode;
+	assembler->relocatable = 0;
+	assembler->dataCursor = 0;
+	assembler->dataFixed = 0;
+	assembler->fedDataBase = 0;
+	assembler->fedDataEnd = 0;
+	memset(&assembler->labels, 0, sizeof(LabelTable));
+	memset(&assembler->patches, 0, sizeof(PatchTable));
+
+	return assembler;
+}
+
+// compiles more tokens onto the end of an assembler, returns 0 if they had an error
+// a line with an error leaves nothing behind so the session can carry on
+int assemblerFeed(Assembler *assembler, Token *tokens){
+	if(tokens == NULL){
+		return 0;	// false
+	}
+
+	// remember where everything was so a failed line can be undone
+	size_t codeLen = assembler->bytecode->codeLen;
+	size_t labelCount = assembler->labels.count;
+	size_t patchCount = assembler->patches.count;
+	size_t dataCursor = assembler->dataCursor;
+	size_t dataBase = assembler->bytecode->dataBase;
+	size_t dataEnd = assembler->bytecode->dataEnd;
+	assembler->fedDataBase = 0;
+	assembler->fedDataEnd = 0;
+
+	jmp_buf errorJump;
+	if(setjmp(errorJump) != 0){
+		recoverPoint = NULL;
+		assembler->bytecode->codeLen = codeLen;
+		assembler->labels.count = labelCount;
+		assembler->patches.count = patchCount;
+
+		// words an earlier line of this feed wrote can't be taken back, but the range and cursor go back to where they were
+		assembler->dataCursor = dataCursor;
+		assembler->bytecode->dataBase = dataBase;
+		assembler->bytecode->dataEnd = dataEnd;
+		assembler->fedDataBase = 0;
+		assembler->fedDataEnd = 0;
+
+		return 0;	// false
+	}
+
+	// patches are only resolved once the whole feed made it through, so undoing is just resetting the counts
+	recoverPoint = &errorJump;
+	assembleTokens(assembler, tokens);
+	resolvePatches(assembler, labelCount);
+	recoverPoint = NULL;
+
+	return 1;	// true
+}
+
+Bytecode *assemblerBytecode(const Assembler *assembler){
+	return assembler->bytecode;
+}
+
+// how many jumps are still waiting on a label, code with any pending isn't safe to run yet
+size_t assemblerPending(const Assembler *assembler){
+	return assembler->patches.count;
+}
+
+// resolves every pending jump, anything still pending never got its label
+Bytecode *assemblerFinish(Assembler *assembler){
 	// go back and patch through all labels inserting the correct addresses
-	patchLabels(bytecode, &labels, &patches);
+	resolvePatches(assembler, 0);
+	if(assembler->patches.count > 0){
+		const PatchEntry *patch = &assembler->patches.items[0];
+		compilerError(patch->line, "Undefined label '%s'", patch->name);
+	}
+
+	// the room left over from growing goes along with the rest of the compilation, programs only copy out codeLen words
+	return assembler->bytecode;
+}
+
+// appends already compiled code to an assembler, used by the linker to place objects
+void assemblerAppend(Assembler *assembler, const BITSIZE *code, const uint32_t *lines, size_t len){
+	Bytecode *bytecode = assembler->bytecode;
+	for(size_t i = 0; i < len; i++){
+		emitWord(bytecode, code[i]);
+		bytecode->lines[bytecode->codeLen - 1] = lines[i];
+	}
+}
+
+// declares a label at an address, errors on duplicates just like in source
+void assemblerDefine(Assembler *assembler, char *name, size_t address, size_t line, LabelKind kind){
+	addLabel(&assembler->labels, name, address, line, kind);
+}
+
+// records a code word that needs the address of a label once it is known
+void assemblerReference(Assembler *assembler, char *name, size_t index, size_t line, LabelKind kind){
+	recordPatch(&assembler->patches, name, index, line, kind);
+}
+
+// compiles tokens without resolving any labels, the result is written out as a relocatable object
+Assembler *compilerObject(Token *tokens){
+	if(tokens == NULL){
+		return NULL;	// need to have tokens to compile
+	}
+
+	Assembler *assembler = assemblerCreate();
+	assembler->relocatable = 1;
+	assembleTokens(assembler, tokens);
+
+	return assembler;
+}
+
+// main compiler function compiles bytecode based off of a stream of tokens
+Bytecode *compiler(Token *tokens){
+	if(tokens == NULL){
+		return NULL;	// need to have tokens to compile
+	}
+
+	Assembler *assembler = assemblerCreate();
+	assembleTokens(assembler, tokens);
 
 	// return the final bytecode
-	return bytecode;
+	return assemblerFinish(assembler);
 }
@@ -0,0 +1,300 @@
+#include "debug.h"
+#include "program.h"
+#include "repl.h"
+#include "trace.h"
+#include "verify.h"
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OPCODE_SHIFT 10
+#define FIELD_BITS 0x3FF	// dest and src, left alone when the opcode is swapped for BRK
+
+static const char *sourceName(const Debugger *debugger){
+	return debugger->sourcePath != NULL ? debugger->sourcePath : "image";
+}
+
+static uint32_t lineAt(const Debugger *debugger, BITSIZE pc){
+	return pc < debugger->vm->codeLen ? debugger->vm->lines[pc] : 0;
+}
+
+static int findBreakpoint(const Debugger *debugger, BITSIZE address){
+	for(size_t i = 0; i < debugger->breakpointCount; i++){
+		if(debugger->breakpoints[i].address == address){
+			return (int)i;
+		}
+	}
+
+	return -1;
+}
+
+// what is really at an address, looking under a breakpoint if there is one
+static BITSIZE originalWord(const Debugger *debugger, BITSIZE address){
+	int index = findBreakpoint(debugger, address);
+
+	return index >= 0 ? debugger->breakpoints[index].original : debugger->code[address];
+}
+
+static void printLocation(const Debugger *debugger, const char *what){
+	const VM *vm = debugger->vm;
+	BITSIZE pc = vm->registers[REG_PC];
+	printf("%s at 0x%04X (%s:%u) %s\n", what, pc, sourceName(debugger), lineAt(debugger, pc),
+	    traceOpcodeName((originalWord(debugger, pc) >> OPCODE_SHIFT) & 0x3F));
+}
+
+// "12" is the first instruction on source line 12, "*0x1A" is that exact address
+static int parseLocation(const Debugger *debugger, const char *args, BITSIZE *address){
+	const VM *vm = debugger->vm;
+	while(*args == ' ' || *args == '\t'){
+		args++;
+	}
+
+	char *end = NULL;
+	if(*args == '*'){
+		unsigned long value = strtoul(args + 1, &end, 0);
+		if(end == args + 1 || value >= vm->codeLen || !debugger->starts[value]){
+			printf("0x%04lX is not the start of an instruction\n", value);
+			return 0;	// false
+		}
+		*address = (BITSIZE)value;
+		return 1;	// true
+	}
+
+	unsigned long line = strtoul(args, &end, 10);
+	if(end == args){
+		printf("usage: <line> or *<address>\n");
+		return 0;
+	}
+	for(size_t pc = 0; pc < vm->codeLen; pc++){
+		if(debugger->starts[pc] && vm->lines[pc] == line){
+			*address = (BITSIZE)pc;
+			return 1;
+		}
+	}
+	printf("No code on line %lu\n", line);
+
+	return 0;
+}
+
+static void setBreakpoint(Debugger *debugger, const char *args){
+	BITSIZE address;
+	if(!parseLocation(debugger, args, &address)){
+		return;
+	}
+	if(findBreakpoint(debugger, address) >= 0){
+		printf("There is already a breakpoint at 0x%04X\n", address);
+		return;
+	}
+	if(debugger->breakpointCount == DEBUG_MAX_BREAKPOINTS){
+		printf("No room for more than %d breakpoints\n", DEBUG_MAX_BREAKPOINTS);
+		return;
+	}
+
+	Breakpoint *breakpoint = &debugger->breakpoints[debugger->breakpointCount++];
+	breakpoint->address = address;
+	breakpoint->original = debugger->code[address];
+	debugger->code[address] = (BITSIZE)((OP_BRK << OPCODE_SHIFT) | (breakpoint->original & FIELD_BITS));
+	printf("Breakpoint at 0x%04X (%s:%u)\n", address, sourceName(debugger), lineAt(debugger, address));
+}
+
+static void deleteBreakpoint(Debugger *debugger, const char *args){
+	BITSIZE address;
+	if(!parseLocation(debugger, args, &address)){
+		return;
+	}
+	int index = findBreakpoint(debugger, address);
+	if(index < 0){
+		printf("No breakpoint at 0x%04X\n", address);
+		return;
+	}
+
+	debugger->code[address] = debugger->breakpoints[index].original;
+	debugger->breakpoints[index] = debugger->breakpoints[--debugger->breakpointCount];
+}
+
+static void listBreakpoints(const Debugger *debugger){
+	if(debugger->breakpointCount == 0){
+		printf("No breakpoints\n");
+	}
+	for(size_t i = 0; i < debugger->breakpointCount; i++){
+		BITSIZE address = debugger->breakpoints[i].address;
+		printf("0x%04X (%s:%u)\n", address, sourceName(debugger), lineAt(debugger, address));
+	}
+}
+
+// innermost first, callers are shown by the CALL they're waiting on, 2 words before the return address
+static void printBacktrace(const Debugger *debugger){
+	const VM *vm = debugger->vm;
+	BITSIZE pc = vm->registers[REG_PC];
+	printf("#0 0x%04X (%s:%u)\n", pc, sourceName(debugger), lineAt(debugger, pc));
+
+	size_t tracked = vm->returnDepth < RETURN_STACK_SIZE ? vm->returnDepth : RETURN_STACK_SIZE;
+	if(vm->returnDepth > tracked){
+		printf("   ... %zu calls too deep to show\n", vm->returnDepth - tracked);
+	}
+	for(size_t i = tracked; i > 0; i--){
+		BITSIZE call = (BITSIZE)(vm->returnStack[i - 1] - 2);
+		printf("#%zu 0x%04X (%s:%u)\n", tracked - i + 1, call, sourceName(debugger), lineAt(debugger, call));
+	}
+}
+
+// runs until a BRK, the end of the program, or after steps instructions when steps isn't 0
+static int runFor(Debugger *debugger, uint64_t steps){
+	VM *vm = debugger->vm;
+	vm->paused = 0;
+	vm->running = 1;
+	fflush(stdout);	// so what the program prints comes after the prompt's output
+	if(steps > 0 && vm->instructionBudget - vm->instructionCount > steps){
+		vm->instructionLimit = vm->instructionCount + steps;
+	}
+
+	int result = vmExecute(vm);
+	vm->instructionLimit = vm->instructionBudget;
+	fflush(stdout);
+
+	return result;
+}
+
+// steps 0 runs until something stops it
+static void resume(Debugger *debugger, uint64_t steps){
+	VM *vm = debugger->vm;
+	if(debugger->finished){
+		printf("The program has finished\n");
+		return;
+	}
+
+	// a breakpoint under the PC gets its own word back for one step, otherwise it would just stop there again
+	int continuing = steps == 0;
+	BITSIZE pc = vm->registers[REG_PC];
+	int index = findBreakpoint(debugger, pc);
+	int result = 0;
+	if(index >= 0){
+		debugger->code[pc] = debugger->breakpoints[index].original;
+		result = runFor(debugger, 1);
+		debugger->code[pc] = (BITSIZE)((OP_BRK << OPCODE_SHIFT) | (debugger->breakpoints[index].original & FIELD_BITS));
+		steps -= continuing ? 0 : 1;
+	}
+	if(index < 0 || (result == 0 && vm->paused && (continuing || steps > 0))){
+		result = runFor(debugger, steps);
+	}
+
+	if(result != 0){
+		printf("The program stopped on an error\n");
+		debugger->finished = 1;
+		debugger->failed = 1;
+	}
+	else if(vm->paused){
+		printLocation(debugger, findBreakpoint(debugger, vm->registers[REG_PC]) >= 0 ? "Breakpoint" : "Stopped");
+	}
+	else{
+		printf("The program ended after %llu instructions\n", (unsigned long long)vm->instructionCount);
+		debugger->finished = 1;
+	}
+}
+
+// the first word of the line names the command, any prefix of it will do so ":c" is ":continue"
+static const char *matchCommand(const char *line, const char *name){
+	size_t length = strcspn(line, " \t\n");
+	if(length < 2 || length > strlen(name) || strncmp(line, name, length) != 0){
+		return NULL;
+	}
+
+	return line + length;	// the arguments
+}
+
+// handles one line, returns 0 when the session should end
+static int command(Debugger *debugger, const char *line){
+	const char *args;
+	if(matchCommand(line, ":quit") != NULL){
+		return 0;
+	}
+	if((args = matchCommand(line, ":break")) != NULL){
+		setBreakpoint(debugger, args);
+	}
+	else if(matchCommand(line, ":breaks") != NULL){
+		listBreakpoints(debugger);
+	}
+	else if((args = matchCommand(line, ":delete")) != NULL){
+		deleteBreakpoint(debugger, args);
+	}
+	else if((args = matchCommand(line, ":step")) != NULL){
+		char *end = NULL;
+		unsigned long long steps = strtoull(args, &end, 10);
+		resume(debugger, end == args || steps == 0 ? 1 : steps);
+	}
+	else if(matchCommand(line, ":continue") != NULL){
+		resume(debugger, 0);
+	}
+	else if(matchCommand(line, ":where") != NULL){
+		printBacktrace(debugger);
+	}
+	else if(matchCommand(line, ":regs") != NULL){
+		replPrintRegisters(debugger->vm);
+	}
+	else if((args = matchCommand(line, ":mem")) != NULL){
+		replPrintMemory(debugger->vm, args);
+	}
+	else{
+		printf("commands: :break <line | *addr>, :breaks, :delete <line | *addr>, :step [n], :continue, :where, :regs, :mem <addr> [count], :quit\n");
+	}
+	fflush(stdout);
+
+	return 1;
+}
+
+int debugRun(Program *program, const VMOptions *options){
+	Debugger debugger;
+	memset(&debugger, 0, sizeof(debugger));
+	debugger.sourcePath = options != NULL ? options->sourcePath : NULL;
+	debugger.vm = vmCreate(program, options);
+
+	// using malloc since both live exactly as long as the session
+	debugger.code = malloc(sizeof(BITSIZE) * (program->codeLen + 1));
+	debugger.starts = calloc(program->codeLen + 1, 1);
+	if(debugger.code == NULL || debugger.starts == NULL){
+		fprintf(stderr, "Not enough memory for the debugger.\n");
+		exit(74);
+	}
+	memcpy(debugger.code, program->code, sizeof(BITSIZE) * program->codeLen);
+	for(size_t pc = 0; pc < program->codeLen; pc += verifyInstructionWords(program->code[pc])){	// already verified so this always moves on
+		debugger.starts[pc] = 1;
+	}
+	vmAttachCode(debugger.vm, debugger.code, program->lines, program->codeLen);
+	debugger.vm->debugging = 1;
+
+	if(debugger.vm->registers[REG_PC] < program->codeLen){
+		printLocation(&debugger, "Stopped");
+	}
+	else{
+		debugger.finished = 1;
+	}
+	fflush(stdout);
+
+	// commands and the program's input share stdin, both go through the VM's input buffer so neither reads ahead of the other
+	int interactive = isatty(STDIN_FILENO);
+	char line[DEBUG_LINE_SIZE];
+	while(1){
+		if(interactive){
+			printf("(lexi) ");
+			fflush(stdout);
+		}
+		if(!inputReadLine(&debugger.vm->input, line, sizeof(line))){
+			break;	// end of input
+		}
+		if(line[0] == '\0'){
+			continue;
+		}
+		if(!command(&debugger, line)){
+			break;
+		}
+	}
+
+	vmDestroy(debugger.vm);
+	free(debugger.code);
+	free(debugger.starts);
+
+	return debugger.failed ? -1 : 0;
+}
@@ -0,0 +1,263 @@
+#include "device.h"
+#include "channel.h"
+#include "vector.h"
+#include "vm.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// prints the low byte of anything written to the console port
+static void consoleWrite(VM *vm, void *context, BITSIZE port, BITSIZE value){
+	(void)vm;
+	(void)context;
+	(void)port;
+
+	putchar((int)(value & 0xFF));
+	fflush(stdout);
+}
+
+// prints the low byte of every word in one write, the words are narrowed a chunk at a time so the buffer can live on the stack
+void consoleWriteBulk(VM *vm, const BITSIZE *src, size_t len){
+	// something else attached to the console gets every word like it would from PRN
+	if(vm->devices[PORT_CONSOLE - DEVICE_BASE].write != consoleWrite){
+		for(size_t i = 0; i < len; i++){
+			deviceWrite(vm, PORT_CONSOLE, src[i]);
+		}
+		return;
+	}
+
+	uint8_t chunk[CONSOLE_CHUNK];
+	for(size_t done = 0; done < len; ){
+		size_t count = len - done < CONSOLE_CHUNK ? len - done : CONSOLE_CHUNK;
+		vectorNarrow(chunk, src + done, count);
+		fwrite(chunk, 1, count, stdout);
+		done += count;
+	}
+	fflush(stdout);
+}
+
+// about to wait on something outside the VM, so whatever this stage has sent so far has to reach the next one first
+// otherwise a stage holding back fewer than a batch of words can leave the next one waiting on it forever
+void deviceBeforeWait(VM *vm){
+	if(vm->outbound != NULL){
+		channelFlush(vm->outbound);
+	}
+}
+
+// refills the input buffer with one large read, returns 0 once there is nothing left
+static int inputFill(InputDevice *input){
+	if(input->eof){
+		return 0;
+	}
+
+	// the buffer is only made the first time a program actually reads
+	if(input->buffer == NULL){
+		input->buffer = malloc(INPUT_BUFFER_SIZE);
+		if(input->buffer == NULL){
+			fprintf(stderr, "Not enough memory for the input buffer.\n");
+			exit(74);
+		}
+	}
+
+	ssize_t bytesRead;
+	do{
+		bytesRead = read(input->fd, input->buffer, INPUT_BUFFER_SIZE);
+	} while(bytesRead < 0 && errno == EINTR);
+
+	// errors are treated the same as running out of input
+	if(bytesRead <= 0){
+		input->eof = 1;
+		input->start = 0;
+		input->end = 0;
+		return 0;
+	}
+
+	input->start = 0;
+	input->end = (size_t)bytesRead;
+
+	return 1;
+}
+
+// hands out the next input byte
+static BITSIZE inputRead(VM *vm, void *context, BITSIZE port){
+	(void)port;
+	InputDevice *input = context;
+
+	if(input->start == input->end){
+		deviceBeforeWait(vm);	// the read can block
+	}
+	if(input->start == input->end && !inputFill(input)){
+		return INPUT_EOF;
+	}
+
+	return input->buffer[input->start++];
+}
+
+// says if there is anything left without using it up
+static BITSIZE inputStatus(VM *vm, void *context, BITSIZE port){
+	(void)port;
+	InputDevice *input = context;
+
+	if(input->start == input->end){
+		deviceBeforeWait(vm);
+	}
+	if(input->start == input->end && !inputFill(input)){
+		return 1;
+	}
+
+	return 0;
+}
+
+// the core ports are read only, the values are set before the VM starts
+static BITSIZE coreRead(VM *vm, void *context, BITSIZE port){
+	(void)context;
+
+	return port == PORT_CORE_ID ? vm->coreId : vm->coreCount;
+}
+
+// a VM outside of a pipeline has nowhere to send so the word is dropped
+static void channelWritePort(VM *vm, void *context, BITSIZE port, BITSIZE value){
+	(void)context;
+	(void)port;
+
+	if(vm->outbound != NULL){
+		channelSend(vm->outbound, value);
+	}
+}
+
+static BITSIZE channelReadPort(VM *vm, void *context, BITSIZE port){
+	(void)context;
+	(void)port;
+
+	if(vm->inbound == NULL){
+		return CHANNEL_CLOSED;
+	}
+
+	BITSIZE value;
+	if(channelTryReceive(vm->inbound, &value)){
+		return value;
+	}
+
+	deviceBeforeWait(vm);
+	if(!channelReceive(vm->inbound, &value)){
+		return CHANNEL_CLOSED;
+	}
+
+	return value;
+}
+
+static BITSIZE channelStatusPort(VM *vm, void *context, BITSIZE port){
+	(void)context;
+	(void)port;
+
+	deviceBeforeWait(vm);	// a program polling this is waiting on something
+
+	return channelStatus(vm->inbound, vm->outbound);
+}
+
+// copies up to count input bytes into dest one byte per word, returns how many were read
+size_t inputReadBulk(InputDevice *input, BITSIZE *dest, size_t count){
+	size_t total = 0;
+	while(total < count){
+		if(input->start == input->end && !inputFill(input)){
+			break;	// ran out of input
+		}
+
+		// take as much as is buffered in one go
+		size_t available = input->end - input->start;
+		size_t chunk = count - total < available ? count - total : available;
+		const unsigned char *source = input->buffer + input->start;
+		for(size_t i = 0; i < chunk; i++){
+			dest[total + i] = source[i];
+		}
+
+		input->start += chunk;
+		total += chunk;
+	}
+
+	return total;
+}
+
+// reads the next line out of the same buffer the program reads from, so the two never take each other's bytes
+// the newline is dropped and anything past capacity - 1 bytes is skipped, returns 0 once there is nothing left
+int inputReadLine(InputDevice *input, char *line, size_t capacity){
+	size_t length = 0;
+	int any = 0;
+	while(input->start < input->end || inputFill(input)){
+		any = 1;
+		unsigned char ch = input->buffer[input->start++];
+		if(ch == '\n'){
+			break;
+		}
+		if(length + 1 < capacity){
+			line[length++] = (char)ch;
+		}
+	}
+	line[length] = '\0';
+
+	return any;
+}
+
+// clears the device table and attaches the default devices, called when a VM is created
+void deviceInit(VM *vm){
+	memset(vm->devices, 0, sizeof(vm->devices));
+
+	deviceRegister(vm, PORT_CONSOLE, NULL, consoleWrite, NULL);
+
+	// input comes from stdin by default
+	memset(&vm->input, 0, sizeof(vm->input));
+	vm->input.fd = STDIN_FILENO;
+	deviceRegister(vm, PORT_INPUT, inputRead, NULL, &vm->input);
+	deviceRegister(vm, PORT_INPUT_STATUS, inputStatus, NULL, &vm->input);
+
+	deviceRegister(vm, PORT_CORE_ID, coreRead, NULL, NULL);
+	deviceRegister(vm, PORT_CORE_COUNT, coreRead, NULL, NULL);
+
+	deviceRegister(vm, PORT_CHANNEL_SEND, NULL, channelWritePort, NULL);
+	deviceRegister(vm, PORT_CHANNEL_RECEIVE, channelReadPort, NULL, NULL);
+	deviceRegister(vm, PORT_CHANNEL_STATUS, channelStatusPort, NULL, NULL);
+}
+
+// releases anything the devices allocated, called when the VM is done
+void deviceFree(VM *vm){
+	free(vm->input.buffer);	// made with malloc since it is large and lives exactly as long as the VM
+	vm->input.buffer = NULL;
+}
+
+// attaches handlers to a port in the device page, returns 0 if the port is outside of it
+int deviceRegister(VM *vm, BITSIZE port, DeviceRead read, DeviceWrite write, void *context){
+	if(port < DEVICE_BASE){
+		return 0;	// false
+	}
+
+	Device *device = &vm->devices[port - DEVICE_BASE];
+	device->read = read;
+	device->write = write;
+	device->context = context;
+
+	return 1;	// true
+}
+
+// only called for addresses in the device page, the caller has already done the range check
+BITSIZE deviceRead(VM *vm, BITSIZE port){
+	Device *device = &vm->devices[port - DEVICE_BASE];
+	if(device->read == NULL){
+		return vm->memory[port];	// nothing attached so it behaves like RAM
+	}
+
+	return device->read(vm, device->context, port);
+}
+
+void deviceWrite(VM *vm, BITSIZE port, BITSIZE value){
+	Device *device = &vm->devices[port - DEVICE_BASE];
+	if(device->write == NULL){
+		vm->memory[port] = value;	// nothing attached so it behaves like RAM
+		return;
+	}
+
+	// attached ports are never mirrored into memory, the stack grows down through this page and would get written over
+	device->write(vm, device->context, port, value);
+}
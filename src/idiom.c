@@ -0,0 +1,82 @@
+#include "idiom.h"
+#include "verify.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OPERAND_NONE 0x1F
+#define OPERAND_IMMEDIATE 0x1E
+#define OPCODE_SHIFT 10
+#define DEST_SHIFT 5
+
+// the only shapes the compiler emits for these
+#define WORD_DEC ((OP_DEC << OPCODE_SHIFT) | (OPERAND_NONE << DEST_SHIFT) | OPERAND_NONE)
+#define WORD_JUMP(opcode) (((opcode) << OPCODE_SHIFT) | (OPERAND_IMMEDIATE << DEST_SHIFT) | OPERAND_NONE)
+
+Idiom idiomMatch(const BITSIZE *code, size_t codeLen, size_t pc){
+	if(code[pc] != WORD_DEC || pc + 2 >= codeLen){
+		return IDIOM_NONE;
+	}
+	if(code[pc + 1] == WORD_JUMP(OP_JGZ) && code[pc + 2] == pc){
+		return IDIOM_DEC_JGZ;
+	}
+	if(pc + 4 >= codeLen || code[pc + 3] != WORD_JUMP(OP_JMP) || code[pc + 4] != pc){
+		return IDIOM_NONE;
+	}
+	if(code[pc + 1] == WORD_JUMP(OP_JLZ)){
+		return IDIOM_DEC_JLZ;
+	}
+	if(code[pc + 1] == WORD_JUMP(OP_JEZ)){
+		return IDIOM_DEC_JEZ;
+	}
+
+	return IDIOM_NONE;
+}
+
+BITSIZE *idiomFold(const BITSIZE *code, size_t codeLen){
+	BITSIZE *folded = NULL;
+
+	// only the start of an instruction can be the top of a loop, the words after it are left alone so jumping into the middle still works
+	for(size_t pc = 0; pc < codeLen; pc += verifyInstructionWords(code[pc])){
+		Idiom idiom = idiomMatch(code, codeLen, pc);
+		if(idiom == IDIOM_NONE){
+			continue;
+		}
+
+		if(folded == NULL){
+			folded = malloc(sizeof(BITSIZE) * codeLen);
+			if(folded == NULL){
+				fprintf(stderr, "Not enough memory for program.\n");
+				exit(74);
+			}
+			memcpy(folded, code, sizeof(BITSIZE) * codeLen);
+		}
+		folded[pc] = (BITSIZE)((OP_LOOP << OPCODE_SHIFT) | (idiom << DEST_SHIFT) | OPERAND_NONE);
+	}
+
+	return folded;
+}
+
+// k is how many times the DEC runs, the first k >= 1 where the exit test on acc - k passes, with 16 bit wrap around
+void idiomCountdown(Idiom idiom, BITSIZE *acc, uint64_t *instructions){
+	int16_t start = (int16_t)*acc;
+	uint64_t k;
+
+	switch(idiom){
+		case IDIOM_DEC_JGZ:	// leaves once acc - k <= 0
+			k = start > 0 ? (uint64_t)start : start == INT16_MIN ? 32768 : 1;
+			*instructions = 2 * k;
+			break;
+		case IDIOM_DEC_JLZ:	// leaves once acc - k < 0
+			k = start >= 0 ? (uint64_t)start + 1 : start == INT16_MIN ? 32769 : 1;
+			*instructions = 3 * k - 1;	// the last time round doesn't get to the JMP
+			break;
+		default:	// IDIOM_DEC_JEZ, leaves once acc - k == 0
+			k = *acc == 0 ? 65536 : *acc;
+			*instructions = 3 * k - 1;
+			break;
+	}
+
+	*acc = (BITSIZE)(*acc - k);
+}
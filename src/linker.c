@@ -0,0 +1,238 @@
+#include "linker.h"
+#include "compiler.h"
+#include "device.h"
+#include "parser.h"
+#include "scratch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// layout of a relocatable object, all values are in host byte order
+// header, code words, line numbers, data words, labels (exports), patches (every label reference, imports included)
+// each label and patch is four uint32_t values (address or index, line, LabelKind, name length) then the name
+// data without a .org gets packed after the data of the files before it, data placed with .org stays where it is
+typedef struct ObjectHeader{
+	char magic[4];
+	uint32_t version;
+	uint32_t codeLen;
+	uint32_t labelCount;
+	uint32_t patchCount;
+	uint32_t dataBase;
+	uint32_t dataLen;
+	uint32_t flags;	// OBJECT_DATA_FIXED
+} ObjectHeader;
+
+// data the link has placed so far, every file's range has to stay clear of the others
+typedef struct DataLayout{
+	size_t *bases;
+	size_t *ends;
+	size_t count;
+	size_t next;	// past everything placed so far, where data that can move goes
+} DataLayout;
+
+// for reporting object errors, exits like the other file errors
+static void linkerError(const char *path, const char *message){
+	fprintf(stderr, "[Linker][%s]: %s\n", path, message);
+	exit(74);
+}
+
+// writes a symbol (label or patch) as value, line, kind, name
+static int writeSymbol(FILE *file, size_t value, size_t line, LabelKind kind, const char *name){
+	uint32_t fields[4] = {(uint32_t)value, (uint32_t)line, (uint32_t)kind, (uint32_t)strlen(name)};
+
+	return fwrite(fields, sizeof(uint32_t), 4, file) == 4 && fwrite(name, 1, fields[3], file) == fields[3];
+}
+
+// saves an assembler made by compilerObject, returns 0 on failure
+int objectWrite(const Assembler *object, const char *path){
+	FILE *file = fopen(path, "wb");
+	if(file == NULL){
+		return 0;	// false
+	}
+
+	const Bytecode *bytecode = object->bytecode;
+	ObjectHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, OBJECT_MAGIC, 4);
+	header.version = OBJECT_VERSION;
+	header.codeLen = (uint32_t)bytecode->codeLen;
+	header.labelCount = (uint32_t)object->labels.count;
+	header.patchCount = (uint32_t)object->patches.count;
+	header.dataBase = (uint32_t)bytecode->dataBase;
+	header.dataLen = (uint32_t)(bytecode->dataEnd - bytecode->dataBase);
+	header.flags = object->dataFixed ? OBJECT_DATA_FIXED : 0;
+
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+	    fwrite(bytecode->code, sizeof(BITSIZE), bytecode->codeLen, file) == bytecode->codeLen &&
+	    fwrite(bytecode->lines, sizeof(uint32_t), bytecode->codeLen, file) == bytecode->codeLen &&
+	    (header.dataLen == 0 || fwrite(bytecode->data + header.dataBase, sizeof(BITSIZE), header.dataLen, file) == header.dataLen);
+
+	for(size_t i = 0; ok && i < object->labels.count; i++){
+		const LabelEntry *label = &object->labels.items[i];
+		ok = writeSymbol(file, label->address, label->line, label->kind, label->name);
+	}
+	for(size_t i = 0; ok && i < object->patches.count; i++){
+		const PatchEntry *patch = &object->patches.items[i];
+		ok = writeSymbol(file, patch->index, patch->line, patch->kind, patch->name);
+	}
+
+	if(fclose(file) != 0){
+		ok = 0;
+	}
+
+	return ok;
+}
+
+// checks the first bytes of a file for the object magic
+int objectIsObject(const char *path){
+	FILE *file = fopen(path, "rb");
+	if(file == NULL){
+		return 0;	// false, let the parser report the missing file
+	}
+
+	char magic[4];
+	int isObject = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, OBJECT_MAGIC, 4) == 0;
+	fclose(file);
+
+	return isObject;
+}
+
+// reads exactly size bytes or gives up
+static void readExact(FILE *file, void *dest, size_t size, const char *path){
+	if(size > 0 && fread(dest, 1, size, file) != size){
+		linkerError(path, "Object is truncated");
+	}
+}
+
+// reads a symbol written by writeSymbol, the name lives in the scratch like the compiler's own names
+static char *readSymbol(FILE *file, uint32_t *value, uint32_t *line, LabelKind *kind, const char *path){
+	uint32_t fields[4];
+	readExact(file, fields, sizeof(fields), path);
+	if(fields[2] > LABEL_ANY || fields[3] > 4096){
+		linkerError(path, "Object is corrupt");
+	}
+
+	char *name = scratchAlloc(fields[3] + 1);
+	readExact(file, name, fields[3], path);
+	name[fields[3]] = '\0';
+	*value = fields[0];
+	*line = fields[1];
+	*kind = (LabelKind)fields[2];
+
+	return name;
+}
+
+// code labels move with their object's code and data labels with its data
+static size_t placeLabel(size_t codeBase, size_t dataShift, size_t address, LabelKind kind){
+	return kind == LABEL_CODE ? codeBase + address : dataShift + address;
+}
+
+// puts a file's data into the link, returns how far its data labels move
+// data that can move starts at 0 in its own file so it just goes after everything else, fixed data has to fit where it is
+static size_t placeData(Assembler *link, DataLayout *layout, const char *path, const BITSIZE *data, size_t base, size_t len, int fixed){
+	size_t shift = fixed ? 0 : layout->next;
+	if(len == 0){
+		return shift;
+	}
+
+	base += shift;
+	if(base + len > DEVICE_BASE){
+		linkerError(path, "Data runs into the device page once placed after the other files");
+	}
+	for(size_t i = 0; i < layout->count; i++){
+		if(base < layout->ends[i] && layout->bases[i] < base + len){
+			char message[96];
+			snprintf(message, sizeof(message), "Data at 0x%04zX - 0x%04zX overlaps the data of an earlier file", base, base + len - 1);
+			linkerError(path, message);
+		}
+	}
+
+	assemblerPlaceData(link, base, data, len, 0);
+	layout->bases[layout->count] = base;
+	layout->ends[layout->count++] = base + len;
+	layout->next = base + len > layout->next ? base + len : layout->next;
+
+	return shift;
+}
+
+// places an object's code at the end of the link and shifts its labels and patches along with it
+static void linkObject(Assembler *link, DataLayout *layout, const char *path){
+	FILE *file = fopen(path, "rb");
+	if(file == NULL){
+		linkerError(path, "Could not open object");
+	}
+
+	ObjectHeader header;
+	readExact(file, &header, sizeof(header), path);
+	if(memcmp(header.magic, OBJECT_MAGIC, 4) != 0 || header.version != OBJECT_VERSION){
+		linkerError(path, "Not a lexi object or wrong version");
+	}
+	if(header.codeLen > MAXSIZE || (size_t)header.dataBase + header.dataLen > MAXSIZE || (header.flags & ~OBJECT_DATA_FIXED) != 0){
+		linkerError(path, "Object is corrupt");
+	}
+
+	BITSIZE *code = scratchAlloc(sizeof(BITSIZE) * (header.codeLen + 1));
+	uint32_t *lines = scratchAlloc(sizeof(uint32_t) * (header.codeLen + 1));
+	BITSIZE *data = scratchAlloc(sizeof(BITSIZE) * (header.dataLen + 1));
+	readExact(file, code, sizeof(BITSIZE) * header.codeLen, path);
+	readExact(file, lines, sizeof(uint32_t) * header.codeLen, path);
+	readExact(file, data, sizeof(BITSIZE) * header.dataLen, path);
+
+	size_t base = link->bytecode->codeLen;
+	assemblerAppend(link, code, lines, header.codeLen);
+	size_t shift = placeData(link, layout, path, data, header.dataBase, header.dataLen, header.flags & OBJECT_DATA_FIXED);
+
+	uint32_t value, line;
+	LabelKind kind;
+	for(uint32_t i = 0; i < header.labelCount; i++){
+		char *name = readSymbol(file, &value, &line, &kind, path);
+		assemblerDefine(link, name, placeLabel(base, shift, value, kind), line, kind);
+	}
+	for(uint32_t i = 0; i < header.patchCount; i++){
+		char *name = readSymbol(file, &value, &line, &kind, path);
+		if(value >= header.codeLen){
+			linkerError(path, "Object is corrupt");
+		}
+		assemblerReference(link, name, base + value, line, kind);
+	}
+
+	fclose(file);
+}
+
+// same as linkObject but for a source file, it gets assembled as an object in memory first
+static void linkSource(Assembler *link, DataLayout *layout, const char *path){
+	Assembler *object = compilerObject(parser((char *)path));
+	const Bytecode *bytecode = object->bytecode;
+
+	size_t base = link->bytecode->codeLen;
+	assemblerAppend(link, bytecode->code, bytecode->lines, bytecode->codeLen);
+	size_t shift = placeData(link, layout, path, bytecode->data + bytecode->dataBase, bytecode->dataBase,
+	    bytecode->dataEnd - bytecode->dataBase, object->dataFixed);
+
+	for(size_t i = 0; i < object->labels.count; i++){
+		const LabelEntry *label = &object->labels.items[i];
+		assemblerDefine(link, label->name, placeLabel(base, shift, label->address, label->kind), label->line, label->kind);
+	}
+	for(size_t i = 0; i < object->patches.count; i++){
+		const PatchEntry *patch = &object->patches.items[i];
+		assemblerReference(link, patch->name, base + patch->index, patch->line, patch->kind);
+	}
+}
+
+// merges objects and sources in order into one program, execution starts at the first one
+// all labels share one namespace just like a single file, so the patch table resolves across files
+Bytecode *linker(const char **paths, size_t count){
+	Assembler *link = assemblerCreate();
+	DataLayout layout = {scratchAlloc(sizeof(size_t) * count), scratchAlloc(sizeof(size_t) * count), 0, 0};
+	for(size_t i = 0; i < count; i++){
+		if(objectIsObject(paths[i])){
+			linkObject(link, &layout, paths[i]);
+		}
+		else{
+			linkSource(link, &layout, paths[i]);
+		}
+	}
+
+	return assemblerFinish(link);
+}
@@ -1,12 +1,74 @@
 #include "compiler.h"
+#include "debug.h"
+#include "linker.h"
 #include "vm.h"
 #include "main.h"
 #include "parser.h"
+#include "prerun.h"
+#include "profile.h"
+#include "program.h"
+#include "repl.h"
+#include "scratch.h"
+#include "serve.h"
+#include "spmd.h"
+#include "stats.h"
+#include "trace.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
-int main(int argc, char **argv){
+static void usage(void){
+	printf("Usage: ./lexi-lang [-o <image_file>] [--prerun[=instructions]] [--trace[=records]] [--perf-counters] [--budget=instructions] [--stats=<json_file>] [--sample-profile[=hz]] [--cores=N [--shared=base:words]] [--map=<file>@base:words[:ro]] <source_file | object_file>... | <image_file>\n");
+	printf("       ./lexi-lang --batch [options] <source_file | image_file>...\n");
+	printf("       ./lexi-lang --pipeline [options] <source_file | image_file>...\n");
+	printf("       ./lexi-lang -c <source_file> -o <object_file>\n");
+	printf("       ./lexi-lang [--repl <source_file>]\n");
+	printf("       ./lexi-lang --serve <socket>\n");
+	printf("       ./lexi-lang --debug [options] <source_file | object_file>... | <image_file>\n");
+	printf("       ./lexi-lang --client <socket> <any of the above>\n");
+}
+
+// one core runs on this thread like always, more than one gets a thread each
+static int runProgram(Program *program, const VMOptions *options){
+	if(options->cores > 1){
+		return spmdRun(program, options);
+	}
+
+	return vmRun(program, options);
+}
+
+// parses and compiles a source file, or maps it if it is already a compiled image
+// more than one file (or any object) gets linked together in order
+// stats (if not NULL) finds out how much memory the biggest compilation needed
+static Program *loadProgram(const char **paths, size_t count, Stats *stats){
+	int linking = count > 1 || objectIsObject(paths[0]);
+	if(!linking){
+		Program *cached = serveCacheFind(paths[0]);	// only ever finds anything in a run started by --serve
+		if(cached != NULL){
+			return cached;
+		}
+		if(programIsImage(paths[0])){
+			return programLoad(paths[0]);
+		}
+	}
+
+	// tokens, labels, patches and the growing bytecode all come out of one scratch that goes as soon as the program is copied out
+	Scratch *scratch = scratchBegin();
+	Bytecode *bytecode = linking ? linker(paths, count) : compiler(parser((char *)paths[0]));
+	Program *program = programCreate(bytecode);
+	if(stats != NULL && scratchUsed(scratch) > stats->compileBytes){
+		stats->compileBytes = scratchUsed(scratch);
+	}
+	scratchEnd(scratch);
+
+	return program;
+}
+
+// runs a whole command line, main for normal use and the server for every request
+static int command(int argc, char **argv){
 	int stacktop_hint;
 	gcInit(&stacktop_hint, false);
 	// Code Below this point
@@ -14,26 +76,262 @@ int main(int argc, char **argv){
 	// start of execution
 	// in future different modes can be added based on arguements
 	// 	- "-v" for visualization of cpu state
-	// 	- no args for a REPL like thing
-	// 	- more args for multiple files
-	switch(argc){	// based on input
-		case 2:	// if we have an arguement
-			// need to execute parser
-			Token *tokenStream = parser(argv[1]);
-			
-			// need to execute compiler from output of parser
-			Bytecode *bytecode = compiler(tokenStream);
+	const char **paths = gcAlloc(sizeof(char *) * (size_t)argc);	// every file in the order given
+	size_t pathCount = 0;
+	const char *outputPath = NULL;	// "-o" compiles to an image instead of running
+	VMOptions options = {0};
+	bool objectMode = false;	// "-c" compiles a single file to a relocatable object
+	bool replMode = false;	// no source, or "--repl" to preload one
+	bool batchMode = false;	// "--batch" runs every file as its own program instead of linking them
+	bool pipelineMode = false;	// "--pipeline" runs every file at once, each one feeding the next
+	bool debugMode = false;	// "--debug" runs a single program under breakpoints and stepping
+	const char *statsPath = NULL;
+	unsigned long sampleHz = 0;	// "--sample-profile" samples the running VMs this many times a second, 0 leaves it off
+	uint64_t prerunLimit = 0;	// "--prerun" runs the start of the program ahead of time, 0 leaves it alone
+	bool badArgs = false;
+	for(int i = 1; i < argc; i++){
+		if(strcmp(argv[i], "-o") == 0 && i + 1 < argc){
+			outputPath = argv[++i];
+		}
+		else if(strcmp(argv[i], "-c") == 0){
+			objectMode = true;
+		}
+		else if(strcmp(argv[i], "--repl") == 0){
+			replMode = true;
+		}
+		else if(strcmp(argv[i], "--batch") == 0){
+			batchMode = true;
+		}
+		else if(strcmp(argv[i], "--pipeline") == 0){
+			pipelineMode = true;
+		}
+		else if(strcmp(argv[i], "--debug") == 0){
+			debugMode = true;
+		}
+		else if(strncmp(argv[i], "--stats=", 8) == 0 && argv[i][8] != '\0'){	// dynamic counters as JSON, merged over every run
+			statsPath = argv[i] + 8;
+		}
+		else if(strcmp(argv[i], "--sample-profile") == 0){
+			sampleHz = PROFILE_DEFAULT_HZ;
+		}
+		else if(strncmp(argv[i], "--sample-profile=", 17) == 0){	// folded stacks for flame graphs, cheap enough to leave on
+			char *end = NULL;
+			sampleHz = strtoul(argv[i] + 17, &end, 10);
+			if(end == argv[i] + 17 || *end != '\0' || sampleHz == 0 || sampleHz > 1000000){
+				badArgs = true;
+			}
+		}
+		else if(strcmp(argv[i], "--prerun") == 0){
+			prerunLimit = PRERUN_DEFAULT_LIMIT;
+		}
+		else if(strncmp(argv[i], "--prerun=", 9) == 0){	// caps how many instructions get run ahead of time
+			char *end = NULL;
+			prerunLimit = strtoull(argv[i] + 9, &end, 10);
+			if(end == argv[i] + 9 || *end != '\0' || prerunLimit == 0){
+				badArgs = true;
+			}
+		}
+		else if(strcmp(argv[i], "--perf-counters") == 0){	// host cpu counters around the run
+			options.perfCounters = 1;
+		}
+		else if(strcmp(argv[i], "--trace") == 0){	// record into a ring buffer, read it with lexi-trace
+			options.traceRecords = TRACE_DEFAULT_RECORDS;
+		}
+		else if(strncmp(argv[i], "--trace=", 8) == 0){
+			char *end = NULL;
+			options.traceRecords = strtoul(argv[i] + 8, &end, 10);
+			if(end == argv[i] + 8 || *end != '\0' || options.traceRecords == 0){
+				badArgs = true;
+			}
+		}
+		else if(strncmp(argv[i], "--budget=", 9) == 0){	// how many instructions a run may take before it's stopped
+			char *end = NULL;
+			options.instructionLimit = strtoull(argv[i] + 9, &end, 10);
+			if(end == argv[i] + 9 || *end != '\0' || options.instructionLimit == 0){
+				badArgs = true;
+			}
+		}
+		else if(strncmp(argv[i], "--cores=", 8) == 0){	// SPMD, the same program on N threads
+			char *end = NULL;
+			options.cores = strtoul(argv[i] + 8, &end, 10);
+			if(end == argv[i] + 8 || *end != '\0' || options.cores == 0 || options.cores > SPMD_MAX_CORES){
+				badArgs = true;
+			}
+		}
+		else if(strncmp(argv[i], "--shared=", 9) == 0){	// where the window every core sees goes, in words
+			char *end = NULL;
+			unsigned long base = strtoul(argv[i] + 9, &end, 0);
+			if(*end == ':'){
+				options.sharedWords = strtoul(end + 1, &end, 0);
+			}
+			if(*end != '\0' || base >= DEVICE_BASE || options.sharedWords == 0){
+				badArgs = true;
+			}
+			options.sharedBase = (BITSIZE)base;
+		}
+		else if(strncmp(argv[i], "--map=", 6) == 0){	// file@base:words[:ro], shows a host file through a window of memory
+			char *spec = gcAlloc(strlen(argv[i] + 6) + 1);
+			strcpy(spec, argv[i] + 6);
+			char *at = strrchr(spec, '@');	// the path itself may have an @ in it
+			char *end = at;
+			unsigned long base = 0;
+			if(at != NULL && at != spec){
+				*at = '\0';
+				base = strtoul(at + 1, &end, 0);
+				if(*end == ':'){
+					options.mapWords = strtoul(end + 1, &end, 0);
+				}
+				if(strcmp(end, ":ro") == 0){
+					options.mapReadOnly = 1;
+					end += 3;
+				}
+			}
+			if(at == NULL || at == spec || *end != '\0' || base >= DEVICE_BASE || options.mapWords == 0){
+				badArgs = true;
+			}
+			options.mapPath = spec;
+			options.mapBase = (BITSIZE)base;
+		}
+		else if(strncmp(argv[i], "--", 2) == 0){
+			badArgs = true;	// unknown option
+		}
+		else{
+			paths[pathCount++] = argv[i];
+		}
+	}
+	const char *sourcePath = pathCount > 0 ? paths[0] : NULL;
+	if(statsPath != NULL){
+		options.stats = statsCreate();
+	}
+	if(sampleHz > 0){
+		options.profile = profileCreate();
+		if(!profileStart((unsigned)sampleHz)){
+			fprintf(stderr, "Could not start the sampling profiler: %s\n", strerror(errno));
+			badArgs = true;
+		}
+	}
+	int exitCode = 0;
+
+	if(badArgs || (outputPath != NULL && (sourcePath == NULL || replMode || batchMode || pipelineMode)) || (replMode && pathCount > 1) ||
+	    (prerunLimit > 0 && (replMode || batchMode || pipelineMode || objectMode)) ||
+	    (debugMode && (sourcePath == NULL || outputPath != NULL || replMode || batchMode || pipelineMode || objectMode || options.cores > 1))){
+		usage();
+	}
+	else if(pipelineMode){	// every stage is started before any of them run
+		if(pathCount == 0 || pathCount > SPMD_MAX_CORES || batchMode || replMode || options.cores > 1){
+			usage();
+		}
+		else{
+			Program **programs = gcAlloc(sizeof(Program *) * pathCount);
+			for(size_t i = 0; i < pathCount; i++){
+				programs[i] = loadProgram(&paths[i], 1, options.stats);
+			}
+			if(pipelineRun(programs, paths, pathCount, &options) != 0){
+				exitCode = 68;
+			}
+			for(size_t i = 0; i < pathCount; i++){
+				programRelease(programs[i]);
+			}
+		}
+	}
+	else if(batchMode){	// one program per file, an error in one doesn't stop the rest
+		for(size_t i = 0; i < pathCount; i++){
+			Program *program = loadProgram(&paths[i], 1, options.stats);
+			options.sourcePath = paths[i];
+			if(runProgram(program, &options) != 0){
+				exitCode = 68;
+			}
+			programRelease(program);
+		}
+	}
+	else if(objectMode){	// objects are written as is, the labels get resolved when linking
+		if(pathCount != 1 || outputPath == NULL){
+			usage();
+		}
+		else{
+			Scratch *scratch = scratchBegin();
+			int written = objectWrite(compilerObject(parser((char *)sourcePath)), outputPath);
+			scratchEnd(scratch);
+			if(!written){
+				fprintf(stderr, "Could not write object \"%s\".\n", outputPath);
+				gcDestroy();
+				return 74;
+			}
+		}
+	}
+	else if(sourcePath == NULL || replMode){
+		options.sourcePath = sourcePath;
+		repl(sourcePath, &options);
+	}
+	else{
+		Program *program = loadProgram(paths, pathCount, options.stats);
+		if(prerunLimit > 0){	// everything up to the first input goes into the image (or just gets skipped this run)
+			Program *started = prerunProgram(program, prerunLimit);
+			programRelease(program);
+			program = started;
+		}
 
-			// need to execute interpreter on bytecode from compiler
-			vmRun(bytecode);
+		if(outputPath != NULL){	// save the image so later runs can map it instead of compiling
+			if(!programSave(program, outputPath)){
+				fprintf(stderr, "Could not write image \"%s\".\n", outputPath);
+				programRelease(program);
+				gcDestroy();
+				return 74;
+			}
+		}
+		else{
+			// need to execute interpreter on the program
+			options.sourcePath = sourcePath;
+			if((debugMode ? debugRun(program, &options) : runProgram(program, &options)) != 0){
+				exitCode = 68;	// the error has been reported, keep the old exit code
+			}
+		}
+
+		programRelease(program);
+	}
 
-			break;
-		default:
-			printf("Usage: ./lexi-lang <source_file>\n");
-			break;
+	if(options.stats != NULL){
+		if(!statsWrite(options.stats, statsPath)){
+			fprintf(stderr, "Could not write stats \"%s\".\n", statsPath);
+			exitCode = 74;
+		}
+		statsFree(options.stats);
+	}
+	if(options.profile != NULL){
+		profileStop();
+		if(!profileWrite(options.profile, PROFILE_DEFAULT_PATH)){
+			fprintf(stderr, "Could not write profile \"%s\".\n", PROFILE_DEFAULT_PATH);
+			exitCode = 74;
+		}
+		profileFree(options.profile);
 	}
 
 	// Code Above this point
 	gcDestroy();
-	return 0;
+	return exitCode;
+}
+
+// compiles a single source file to an image for the server's cache
+static int compileImage(const char *sourcePath, const char *imagePath){
+	int stacktop_hint;
+	gcInit(&stacktop_hint, false);
+
+	Program *program = loadProgram(&sourcePath, 1, NULL);
+	int ok = programSave(program, imagePath);
+	programRelease(program);
+
+	gcDestroy();
+	return ok ? 0 : 74;
+}
+
+int main(int argc, char **argv){
+	// the server only forks off runs and the client only passes its command line along
+	if(argc == 3 && strcmp(argv[1], "--serve") == 0){
+		return serveRun(argv[2], command, compileImage);
+	}
+	if(argc >= 3 && strcmp(argv[1], "--client") == 0){
+		return serveClient(argv[2], argc - 3, argv + 3);
+	}
+
+	return command(argc, argv);
 }
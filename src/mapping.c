@@ -0,0 +1,108 @@
+#include "mapping.h"
+#include "vm.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// writing a bank number slides the window, banks past the end of the file read as 0
+static void bankWrite(VM *vm, void *context, BITSIZE port, BITSIZE value){
+	(void)port;
+	Mapping *mapping = context;
+
+	if(!mappingSelect(vm, mapping, value)){
+		fprintf(stderr, "[Map]: Could not switch to bank %u.\n", value);
+	}
+}
+
+static BITSIZE bankRead(VM *vm, void *context, BITSIZE port){
+	(void)vm;
+	Mapping *mapping = context;
+
+	return port == PORT_MAP_BANK ? mapping->bank : mapping->bankCount;
+}
+
+// maps slice bank of the file over the window, the part of the window past the end of the file gets zero pages
+// a mapping can't go past the end of the file (touching it raises SIGBUS) so the split is rounded to whole pages
+int mappingSelect(VM *vm, Mapping *mapping, BITSIZE bank){
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t length = mapping->words * sizeof(BITSIZE);
+	size_t offset = (size_t)bank * length;
+
+	size_t fileBytes = 0;	// how much of the window the file covers
+	if(offset < mapping->fileSize){
+		fileBytes = mapping->fileSize - offset;
+		fileBytes = fileBytes < length ? (fileBytes + page - 1) / page * page : length;
+	}
+
+	// private either way so the file itself never changes, the read only check happens in the VM
+	int prot = mapping->readOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+	size_t fileWords = fileBytes / sizeof(BITSIZE);
+	if(fileWords > 0 && !vmMapWindow(vm, mapping->base, fileWords, mapping->fd, (off_t)offset, prot, MAP_PRIVATE)){
+		return 0;
+	}
+	if(fileWords < mapping->words && !vmMapWindow(vm, (BITSIZE)(mapping->base + fileWords), mapping->words - fileWords, -1, 0, prot, MAP_PRIVATE | MAP_ANONYMOUS)){
+		return 0;
+	}
+
+	mapping->bank = bank;
+
+	return 1;
+}
+
+Mapping *mappingCreate(VM *vm, const char *path, BITSIZE base, size_t words, int readOnly){
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		return NULL;
+	}
+
+	struct stat info;
+	if(fstat(fd, &info) != 0){
+		close(fd);
+		return NULL;
+	}
+
+	// using malloc since it lives exactly as long as the VM
+	Mapping *mapping = malloc(sizeof(Mapping));
+	if(mapping == NULL){
+		fprintf(stderr, "Not enough memory for a file mapping.\n");
+		exit(74);
+	}
+
+	size_t length = words * sizeof(BITSIZE);
+	size_t banks = words > 0 ? ((size_t)info.st_size + length - 1) / length : 0;
+	mapping->fd = fd;
+	mapping->fileSize = (size_t)info.st_size;
+	mapping->base = base;
+	mapping->words = words;
+	mapping->readOnly = readOnly;
+	mapping->bank = 0;
+	mapping->bankCount = (BITSIZE)(banks > 0xFFFF ? 0xFFFF : banks);	// the rest of the file can't be selected
+
+	if(!mappingSelect(vm, mapping, 0)){
+		mappingFree(mapping);
+		return NULL;
+	}
+
+	if(readOnly){
+		vm->readOnlyBase = base;
+		vm->readOnlyWords = words;
+	}
+	deviceRegister(vm, PORT_MAP_BANK, bankRead, bankWrite, mapping);
+	deviceRegister(vm, PORT_MAP_BANKS, bankRead, NULL, mapping);
+
+	return mapping;
+}
+
+// the window itself goes away with the rest of the VM's memory
+void mappingFree(Mapping *mapping){
+	if(mapping == NULL){
+		return;
+	}
+
+	close(mapping->fd);
+	free(mapping);
+}
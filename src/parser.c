@@ -1,7 +1,9 @@
 #include "main.h"
 #include "parser.h"
+#include "scratch.h"
 
 #include <ctype.h>
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,9 +27,15 @@ typedef struct TokenArray{
 // global tokenArray
 static TokenArray tokenArray;
 
+// where parserError goes instead of exiting while parserString is running
+static jmp_buf *recoverPoint = NULL;
+
 // for reporting errors while parsing, gives line and a message
 static void parserError(size_t line, const char *message){
 	fprintf(stderr, "[Parser][Line %zu]: %s\n", line, message);
+	if(recoverPoint != NULL){
+		longjmp(*recoverPoint, 1);
+	}
 	exit(65);	// 65 will be exit code for parsing error
 }
 
@@ -41,7 +49,7 @@ static void initArray(void){
 // adds a token to the end of the list
 static void pushToken(Token *token){
 	// creates empty node with values of token
-	TokenNode *tokenNode = gcAlloc(sizeof(TokenNode));
+	TokenNode *tokenNode = scratchAlloc(sizeof(TokenNode));
 	tokenNode->token = token;
 	tokenNode->next = NULL;
 	tokenNode->prev = tokenArray.tail;
@@ -101,7 +109,7 @@ static bool isRegisterName(const char *lexeme, size_t len){
 // creates a token based on the contents of the char
 static Token *createToken(const char *start, const char *end, TokenType type, size_t line){
 	// allocate the token
-	Token *token = gcAlloc(sizeof(Token));
+	Token *token = scratchAlloc(sizeof(Token));
 	size_t length = 0;
 
 	if(start != NULL && end != NULL && end >= start){
@@ -111,11 +119,11 @@ static Token *createToken(const char *start, const char *end, TokenType type, si
 	// initialize the lexeme for token
 	char *lexeme = NULL;
 	if(length > 0){
-		lexeme = gcAlloc(length + 1);
+		lexeme = scratchAlloc(length + 1);
 		memcpy(lexeme, start, length);
 		lexeme[length] = '\0';
 	} else{
-		lexeme = gcAlloc(1);
+		lexeme = scratchAlloc(1);
 		lexeme[0] = '\0';
 	}
 
@@ -229,6 +237,11 @@ static Token *scanToken(const char **cursor, size_t *line, bool *firstToken){
 				(*cursor)++;
 			}
 		}
+		else if(isAlpha(**cursor) && *cursor == start + 1){	// the address of a label, no sign allowed
+			while(isAlpha(**cursor) || isDigit(**cursor)){
+				(*cursor)++;
+			}
+		}
 		else{	// should be a integer value instead
 			if(!isDigit(**cursor)){	// if not a number
 				parserError(*line, "Immediate literal missing digits");
@@ -242,6 +255,29 @@ static Token *scanToken(const char **cursor, size_t *line, bool *firstToken){
 		// set token type
 		type = TOKEN_IMMD;
 	}
+	else if(ch == '.' && *firstToken && isAlpha((*cursor)[1])){	// directives start with '.'
+		(*cursor)++;
+		while(isAlpha(**cursor) || isDigit(**cursor)){
+			(*cursor)++;
+		}
+
+		type = TOKEN_DIRECTIVE;
+	}
+	else if(ch == '"'){	// strings go to the closing quote, a backslash keeps the next character in the string
+		(*cursor)++;
+		while(**cursor != '"'){
+			if(**cursor == '\0' || **cursor == '\n'){
+				parserError(*line, "Unterminated string literal");
+			}
+			if(**cursor == '\\' && (*cursor)[1] != '\0' && (*cursor)[1] != '\n'){
+				(*cursor)++;
+			}
+			(*cursor)++;
+		}
+
+		(*cursor)++;	// past the closing quote
+		type = TOKEN_STRING;
+	}
 	else if(isAlpha(ch)){	// if the lexeme starts with a character
 		(*cursor)++;
 
@@ -254,7 +290,9 @@ static Token *scanToken(const char **cursor, size_t *line, bool *firstToken){
 		type = resolveIdentifierType(start,(size_t)(*cursor - start), *firstToken);
 	}
 	else if(isDigit(ch) || ch == '-'){	// if cursor is on a number
-		(*cursor)++;
+		if(ch == '-'){
+			(*cursor)++;	// move past the sign, the digits are checked below
+		}
 
 		// create a temp cursor to parse the number
 		const char *numberCursor = *cursor;
@@ -339,12 +377,11 @@ static char *readFile(const char *path){
 	return buffer;
 }
 
-// takes in a file path and returns a stream of tokens based on the contents
-Token *parser(char *pathToFile){
+// turns source text into a raw array of tokens ending with TOKEN_END, line numbers start at firstLine
+static Token *tokenize(const char *source, size_t firstLine){
 	initArray();	// need an array to store tokens in as they come dynamically
-	char *fileContent = readFile(pathToFile);	// get the file in a char buffer
-	const char *cursor = fileContent;	// make a cursor at the start of the buffer
-	size_t line = 1;	// first line is 1, not 0
+	const char *cursor = source;	// make a cursor at the start of the buffer
+	size_t line = firstLine;
 	bool firstTokenInLine = true;	// used to determine if it's an op (or lable if starts with @)
 
 	// go over the entire file
@@ -364,7 +401,7 @@ Token *parser(char *pathToFile){
 	pushToken(endToken);
 
 	// turn the array that we made into a raw c list to be passed to other functions (compiler)
-	Token *tokenList = gcAlloc(sizeof(Token) * tokenArray.len);
+	Token *tokenList = scratchAlloc(sizeof(Token) * tokenArray.len);
 	TokenNode *node = tokenArray.head;
 	size_t index = 0;
 	while(node != NULL){
@@ -372,9 +409,35 @@ Token *parser(char *pathToFile){
 		node = node->next;
 	}
 
+	initArray();	// not actually initing just sets everything to null and 0
+
+	return tokenList;
+}
+
+// takes in a file path and returns a stream of tokens based on the contents
+Token *parser(char *pathToFile){
+	char *fileContent = readFile(pathToFile);	// get the file in a char buffer
+	Token *tokenList = tokenize(fileContent, 1);	// first line is 1, not 0
+
 	// cleanup and return
 	free(fileContent);	// freeing that buffer from readFile made with malloc
-	initArray();	// not actually initing just sets everything to null and 0
 	
 	return tokenList;
 }
+
+// tokenizes a string instead of a file (used by the REPL), returns NULL instead of exiting on errors
+Token *parserString(const char *source, size_t firstLine){
+	jmp_buf errorJump;
+	if(setjmp(errorJump) != 0){
+		recoverPoint = NULL;
+		initArray();	// drop whatever was half built
+
+		return NULL;
+	}
+
+	recoverPoint = &errorJump;
+	Token *tokenList = tokenize(source, firstLine);
+	recoverPoint = NULL;
+
+	return tokenList;
+}
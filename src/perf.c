@@ -0,0 +1,144 @@
+#include "perf.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static const char *counterNames[PERF_COUNTER_COUNT] = {
+	"cycles", "instructions", "branch-misses", "L1d-misses"
+};
+
+// time stamp counter where there is one, otherwise nanoseconds
+static uint64_t readTicks(void){
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static uint64_t readNanos(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+#ifdef __linux__
+// opens one user space counter for this thread, starts disabled so everything can be enabled together
+static int openCounter(uint32_t type, uint64_t config){
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;	// kernel counting is usually what gets refused, and the VM is all user space anyway
+	attr.exclude_hv = 1;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+// opens whatever counters are allowed and starts them, counters that are refused are just left out
+void perfStart(PerfCounters *perf){
+	memset(perf, 0, sizeof(PerfCounters));
+	for(int i = 0; i < PERF_COUNTER_COUNT; i++){
+		perf->fds[i] = -1;
+	}
+
+#ifdef __linux__
+	static const uint32_t types[PERF_COUNTER_COUNT] = {
+		PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE
+	};
+	static const uint64_t configs[PERF_COUNTER_COUNT] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES,
+		PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+	};
+
+	for(int i = 0; i < PERF_COUNTER_COUNT; i++){
+		perf->fds[i] = openCounter(types[i], configs[i]);
+		if(perf->fds[i] < 0){
+			if(perf->openError == 0){
+				perf->openError = errno;
+			}
+			continue;
+		}
+		perf->supported |= 1u << i;
+	}
+
+	for(int i = 0; i < PERF_COUNTER_COUNT; i++){
+		if(perf->fds[i] >= 0){
+			ioctl(perf->fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(perf->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#else
+	perf->openError = ENOSYS;
+#endif
+
+	perf->startNanos = readNanos();
+	perf->startTicks = readTicks();
+}
+
+// stops the counters and keeps their values, the descriptors are closed here
+void perfStop(PerfCounters *perf){
+	perf->ticks = readTicks() - perf->startTicks;
+	perf->nanos = readNanos() - perf->startNanos;
+
+#ifdef __linux__
+	for(int i = 0; i < PERF_COUNTER_COUNT; i++){
+		if(perf->fds[i] < 0){
+			continue;
+		}
+
+		ioctl(perf->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		uint64_t value = 0;
+		if(read(perf->fds[i], &value, sizeof(value)) == (ssize_t)sizeof(value)){
+			perf->values[i] = value;
+		}
+		close(perf->fds[i]);
+		perf->fds[i] = -1;
+	}
+#endif
+}
+
+// prints the raw counters next to the VM instruction count plus the per instruction ratios
+void perfReport(const PerfCounters *perf, uint64_t vmInstructions, FILE *out){
+	double perInstruction = vmInstructions > 0 ? 1.0 / (double)vmInstructions : 0.0;
+
+	fprintf(out, "[Perf]: %llu VM instructions in %.6f s\n", (unsigned long long)vmInstructions, (double)perf->nanos / 1e9);
+	if(perf->supported == 0){	// containers and locked down kernels end up here
+		fprintf(out, "[Perf]: hardware counters unavailable (%s), using timestamps\n", strerror(perf->openError));
+		fprintf(out, "[Perf]: %llu ticks, %.2f ticks per VM instruction, %.2f ns per VM instruction\n",
+		    (unsigned long long)perf->ticks, (double)perf->ticks * perInstruction, (double)perf->nanos * perInstruction);
+		return;
+	}
+
+	for(int i = 0; i < PERF_COUNTER_COUNT; i++){
+		if(!(perf->supported & (1u << i))){
+			fprintf(out, "[Perf]: %-14s not supported\n", counterNames[i]);
+			continue;
+		}
+		fprintf(out, "[Perf]: %-14s %llu\n", counterNames[i], (unsigned long long)perf->values[i]);
+	}
+
+	fprintf(out, "[Perf]: %.2f host cycles per VM instruction, %.2f host instructions per VM instruction\n",
+	    (double)perf->values[PERF_CYCLES] * perInstruction, (double)perf->values[PERF_INSTRUCTIONS] * perInstruction);
+	fprintf(out, "[Perf]: %.4f branch misses per dispatch, %.4f L1d misses per dispatch\n",
+	    (double)perf->values[PERF_BRANCH_MISSES] * perInstruction, (double)perf->values[PERF_L1D_MISSES] * perInstruction);
+}
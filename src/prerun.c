@@ -0,0 +1,203 @@
+#include "prerun.h"
+#include "program.h"
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OPERAND_IMMEDIATE 0x1E
+
+static int isKnown(const Prerun *prerun, size_t address){
+	return (prerun->known[address >> 3] >> (address & 7)) & 1;
+}
+
+static void markKnown(Prerun *prerun, size_t address){
+	prerun->known[address >> 3] |= (uint8_t)(1u << (address & 7));
+}
+
+// a range the VM would turn down is left for the real run so the error happens there
+static int rangeKnown(const Prerun *prerun, BITSIZE base, BITSIZE len){
+	if((size_t)base + len > DEVICE_BASE){
+		return 0;
+	}
+	for(size_t i = base; i < (size_t)base + len; i++){
+		if(!isKnown(prerun, i)){
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// the console while prerunning, what gets printed is kept so the real run can print it again
+static void captureWrite(VM *vm, void *context, BITSIZE port, BITSIZE value){
+	(void)vm;
+	(void)port;
+	Prerun *prerun = context;
+
+	if(prerun->outputLen == prerun->outputCapacity){
+		prerun->outputCapacity = prerun->outputCapacity == 0 ? 256 : prerun->outputCapacity * 2;
+		prerun->output = realloc(prerun->output, prerun->outputCapacity);
+		if(prerun->output == NULL){
+			fprintf(stderr, "Not enough memory for prerun output.\n");
+			exit(74);
+		}
+	}
+	prerun->output[prerun->outputLen++] = (unsigned char)value;
+}
+
+// the PC has already moved past the instruction word, so anything after it is at pc + 1
+// the code has been verified so every field names a real register and every immediate is there
+int prerunAllows(VM *vm, BITSIZE pc, Opcode opcode, int destField, int srcField){
+	Prerun *prerun = vm->prerun;
+	const BITSIZE *registers = vm->registers;
+	BITSIZE immediate = (size_t)pc + 1 < vm->codeLen ? vm->code[pc + 1] : 0;
+
+	if(vm->instructionCount >= prerun->limit){
+		return 0;	// start wherever it got to
+	}
+
+	switch(opcode){
+		case OP_LD:	// device reads and memory nobody wrote could be anything at run time
+			return immediate < DEVICE_BASE && isKnown(prerun, immediate);
+		case OP_ST:
+			if(immediate < DEVICE_BASE){
+				markKnown(prerun, immediate);
+				return 1;
+			}
+			return immediate == PORT_CONSOLE;
+		case OP_PUSH:
+			markKnown(prerun, (BITSIZE)(registers[REG_SP] - 1));
+			return 1;
+		case OP_CALL:
+			markKnown(prerun, (BITSIZE)(registers[REG_SP] - 1));
+			return immediate < vm->codeLen;
+		case OP_POP:
+			return vm->stackCount > 0 && isKnown(prerun, registers[REG_SP]);
+		case OP_RET:
+			return vm->stackCount > 0 && isKnown(prerun, registers[REG_SP]) && vm->memory[registers[REG_SP]] < vm->codeLen;
+		case OP_JMP:
+		case OP_JEZ:
+		case OP_JLZ:
+		case OP_JGZ:
+		case OP_JEQ:
+		case OP_JNE:
+		case OP_JLT:
+		case OP_JGE:
+		case OP_JLTU:
+		case OP_JGEU:
+			return immediate < vm->codeLen;
+		case OP_DIV:
+		case OP_MOD:
+			return (srcField == OPERAND_IMMEDIATE ? immediate : registers[destField]) != 0;
+		case OP_VADD:
+		case OP_VSUB:
+		case OP_VMUL:
+		case OP_VAND:
+		case OP_VXOR:{	// the length register is in the next word, dest is read as well as written
+			BITSIZE len = registers[immediate];
+			return rangeKnown(prerun, registers[destField], len) && rangeKnown(prerun, registers[srcField], len);
+		}
+		case OP_VSUM:
+		case OP_PRS:
+			return rangeKnown(prerun, registers[destField], registers[srcField]);
+		case OP_PRZ:
+			for(size_t i = registers[destField]; i < DEVICE_BASE && isKnown(prerun, i); i++){
+				if(vm->memory[i] == 0){
+					return 1;
+				}
+			}
+			return 0;
+		case OP_XCHG:
+		case OP_CAS:
+		case OP_FADD:
+			return registers[srcField] < DEVICE_BASE && isKnown(prerun, registers[srcField]);
+		case OP_RDS:	// input
+		case OP_BAR:	// other cores
+		case OP_HLT:	// starting right on the HLT keeps halting up to the real run
+			return 0;
+		default:	// only touches registers
+			return 1;
+	}
+}
+
+Program *prerunProgram(Program *program, uint64_t limit){
+	if(program->start != NULL){
+		return programRetain(program);	// already starts part way in
+	}
+
+	// using malloc since it is large and only lives for this call
+	Prerun *prerun = calloc(1, sizeof(Prerun));
+	if(prerun == NULL){
+		fprintf(stderr, "Not enough memory for prerun.\n");
+		exit(74);
+	}
+	prerun->limit = limit;
+	for(size_t i = 0; i < program->runCount; i++){	// the data directives are part of the program
+		for(size_t j = 0; j < program->runs[i].len; j++){
+			markKnown(prerun, program->runs[i].base + j);
+		}
+	}
+
+	VM *vm = vmCreate(program, NULL);
+	vm->prerun = prerun;
+	deviceRegister(vm, PORT_CONSOLE, NULL, captureWrite, prerun);
+
+	Program *started = programRetain(program);
+	if(vmExecute(vm) != 0){
+		fprintf(stderr, "[Prerun]: The program stopped on an error, it will run from the beginning.\n");
+	}
+	else if(vm->instructionCount > 0){
+		// everything it wrote below the device page becomes the data, one run per stretch of written words
+		// the words it never wrote are left out so the image can go wherever the source could, like next to a mapped file
+		// using malloc since both are large and only live for this call
+		DataRun *runs = malloc(sizeof(DataRun) * (DEVICE_BASE / 2 + 1));
+		BITSIZE *words = malloc(sizeof(BITSIZE) * DEVICE_BASE);
+		if(runs == NULL || words == NULL){
+			fprintf(stderr, "Not enough memory for prerun.\n");
+			exit(74);
+		}
+		size_t runCount = 0;
+		size_t wordCount = 0;
+		for(size_t i = 0; i < DEVICE_BASE; i++){
+			if(!isKnown(prerun, i)){
+				continue;
+			}
+			if(runCount == 0 || runs[runCount - 1].base + runs[runCount - 1].len != i){
+				runs[runCount].base = (uint32_t)i;
+				runs[runCount++].len = 0;
+			}
+			runs[runCount - 1].len++;
+			words[wordCount++] = vm->memory[i];
+		}
+
+		ProgramStart *start = malloc(sizeof(ProgramStart) + prerun->outputLen);
+		if(start == NULL){
+			fprintf(stderr, "Not enough memory for prerun.\n");
+			exit(74);
+		}
+		start->stackCount = (uint32_t)vm->stackCount;
+		start->outputLen = (uint32_t)prerun->outputLen;
+		memcpy(start->registers, vm->registers, sizeof(start->registers));
+		start->flags = vm->flags;
+		memcpy(start->page, &vm->memory[DEVICE_BASE], sizeof(start->page));
+		if(prerun->outputLen > 0){
+			memcpy(start->output, prerun->output, prerun->outputLen);
+		}
+
+		programRelease(started);
+		started = programWithStart(program, runs, runCount, words, start);
+		fprintf(stderr, "[Prerun]: Ran %llu instructions ahead of time, the program now starts at 0x%04X.\n",
+		    (unsigned long long)vm->instructionCount, vm->registers[REG_PC]);
+		free(start);
+		free(runs);
+		free(words);
+	}
+
+	vmDestroy(vm);
+	free(prerun->output);
+	free(prerun);
+
+	return started;
+}
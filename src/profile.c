@@ -0,0 +1,245 @@
+#include "profile.h"
+#include "vm.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+// the merged profile uses malloc since it lives across several VMs and outside the gc's view
+
+static void *profileAlloc(size_t size){
+	void *memory = calloc(1, size);
+	if(memory == NULL){
+		fprintf(stderr, "Not enough memory for the profile.\n");
+		exit(74);
+	}
+
+	return memory;
+}
+
+Profile *profileCreate(void){
+	Profile *profile = profileAlloc(sizeof(Profile));
+	profile->tableSize = 256;
+	profile->table = profileAlloc(sizeof(size_t) * profile->tableSize);
+
+	return profile;
+}
+
+void profileFree(Profile *profile){
+	if(profile == NULL){
+		return;
+	}
+
+	for(size_t i = 0; i < profile->stackCount; i++){
+		free(profile->stacks[i].folded);
+	}
+	free(profile->stacks);
+	free(profile->table);
+	free(profile);
+}
+
+ProfileSamples *profileSamplesCreate(const char *source){
+	ProfileSamples *samples = profileAlloc(sizeof(ProfileSamples));
+	samples->source = source;
+
+	return samples;
+}
+
+void profileSamplesFree(ProfileSamples *samples){
+	free(samples);
+}
+
+static uint32_t hashWords(const BITSIZE *words, size_t count, uint32_t hash){
+	for(size_t i = 0; i < count; i++){
+		hash = (hash ^ (words[i] & 0xFF)) * FNV_PRIME;
+		hash = (hash ^ (words[i] >> 8)) * FNV_PRIME;
+	}
+
+	return hash;
+}
+
+static uint32_t hashText(const char *text){
+	uint32_t hash = FNV_OFFSET;
+	for(const char *c = text; *c != '\0'; c++){
+		hash = (hash ^ (uint8_t)*c) * FNV_PRIME;
+	}
+
+	return hash;
+}
+
+// runs inside the signal handler, so nothing here may allocate, lock or touch stdio
+static void recordSample(ProfileSamples *samples, const VM *vm){
+	BITSIZE frames[PROFILE_DEPTH];
+	size_t tracked = vm->returnDepth < RETURN_STACK_SIZE ? vm->returnDepth : RETURN_STACK_SIZE;
+	size_t depth = tracked < PROFILE_DEPTH - 1 ? tracked : PROFILE_DEPTH - 1;
+	uint16_t truncated = vm->returnDepth > depth;	// deeper calls than there's room for, or the shadow stack overflowed
+	for(size_t i = 0; i < depth; i++){
+		frames[i] = vm->returnStack[i];
+	}
+	frames[depth++] = vm->samplePc;
+
+	uint32_t hash = hashWords(frames, depth, FNV_OFFSET ^ truncated);
+	hash = hash == 0 ? 1 : hash;	// 0 is an empty slot
+
+	for(uint32_t index = hash & (PROFILE_SLOTS - 1);; index = (index + 1) & (PROFILE_SLOTS - 1)){
+		ProfileSlot *slot = &samples->slots[index];
+		if(slot->hash == 0){
+			// keep a quarter of the table free so probes stay short, a stack that doesn't fit is only counted
+			if(samples->slotsUsed >= PROFILE_SLOTS / 4 * 3 || samples->framesUsed + depth > PROFILE_FRAME_WORDS){
+				samples->dropped++;
+				return;
+			}
+			memcpy(&samples->frames[samples->framesUsed], frames, sizeof(BITSIZE) * depth);
+			slot->offset = samples->framesUsed;
+			slot->depth = (uint16_t)depth;
+			slot->truncated = truncated;
+			slot->count = 1;
+			slot->hash = hash;
+			samples->framesUsed += (uint32_t)depth;
+			samples->slotsUsed++;
+			return;
+		}
+		if(slot->hash == hash && slot->depth == depth && slot->truncated == truncated &&
+		    memcmp(&samples->frames[slot->offset], frames, sizeof(BITSIZE) * depth) == 0){
+			slot->count++;
+			return;
+		}
+	}
+}
+
+// SIGPROF lands on whichever thread was using the cpu, if that's a VM it gets the sample
+static void onSample(int signal){
+	(void)signal;
+	int savedErrno = errno;
+
+	VM *vm = vmActive();
+	if(vm != NULL && vm->samples != NULL){
+		recordSample(vm->samples, vm);
+	}
+
+	errno = savedErrno;
+}
+
+int profileStart(unsigned hz){
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onSample;
+	action.sa_flags = SA_RESTART;	// reads from stdin and the like just carry on
+	sigemptyset(&action.sa_mask);
+	if(sigaction(SIGPROF, &action, NULL) != 0){
+		return 0;	// false
+	}
+
+	struct itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	long interval = 1000000L / (long)hz;
+	timer.it_interval.tv_usec = interval > 0 ? interval : 1;
+	timer.it_value = timer.it_interval;
+
+	return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+void profileStop(void){
+	struct itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+	signal(SIGPROF, SIG_IGN);	// one may still be on its way
+}
+
+// appends "source:line" for an address, or the raw address when there's no line for it
+static size_t appendFrame(char *buffer, size_t used, size_t capacity, const char *source, const uint32_t *lines, size_t codeLen, BITSIZE pc){
+	const char *separator = used > 0 ? ";" : "";
+	int written;
+	if(lines != NULL && pc < codeLen){
+		written = snprintf(buffer + used, capacity - used, "%s%s:%u", separator, source, lines[pc]);
+	}
+	else{
+		written = snprintf(buffer + used, capacity - used, "%s%s:0x%04X", separator, source, pc);
+	}
+
+	return written > 0 && used + (size_t)written < capacity ? used + (size_t)written : capacity - 1;
+}
+
+static void addStack(Profile *profile, char *folded, uint64_t count){
+	size_t index = hashText(folded) & (profile->tableSize - 1);
+	while(profile->table[index] != 0){
+		ProfileStack *stack = &profile->stacks[profile->table[index] - 1];
+		if(strcmp(stack->folded, folded) == 0){
+			stack->count += count;
+			free(folded);
+			return;
+		}
+		index = (index + 1) & (profile->tableSize - 1);
+	}
+
+	ProfileStack *stacks = realloc(profile->stacks, sizeof(ProfileStack) * (profile->stackCount + 1));
+	if(stacks == NULL){
+		fprintf(stderr, "Not enough memory for the profile.\n");
+		exit(74);
+	}
+	profile->stacks = stacks;
+	stacks[profile->stackCount].folded = folded;
+	stacks[profile->stackCount].count = count;
+	profile->table[index] = ++profile->stackCount;
+
+	// keep the table at most half full, everything gets put back in since the slots depend on the size
+	if(profile->stackCount * 2 > profile->tableSize){
+		free(profile->table);
+		profile->tableSize *= 2;
+		profile->table = profileAlloc(sizeof(size_t) * profile->tableSize);
+		for(size_t i = 0; i < profile->stackCount; i++){
+			for(index = hashText(profile->stacks[i].folded) & (profile->tableSize - 1); profile->table[index] != 0; index = (index + 1) & (profile->tableSize - 1));
+			profile->table[index] = i + 1;
+		}
+	}
+}
+
+void profileMerge(Profile *into, const ProfileSamples *from, const uint32_t *lines, size_t codeLen){
+	const char *source = from->source != NULL ? from->source : "repl";
+	into->dropped += from->dropped;
+
+	for(size_t i = 0; i < PROFILE_SLOTS; i++){
+		const ProfileSlot *slot = &from->slots[i];
+		if(slot->hash == 0){
+			continue;
+		}
+
+		size_t capacity = (size_t)(slot->depth + 1) * (strlen(source) + 16);
+		char *folded = profileAlloc(capacity);
+		size_t used = 0;
+		const BITSIZE *frames = &from->frames[slot->offset];
+		for(size_t j = 0; j + 1 < slot->depth; j++){	// every caller is shown by the CALL it's waiting on, 2 words before its return address
+			used = appendFrame(folded, used, capacity, source, lines, codeLen, frames[j] >= 2 ? frames[j] - 2 : frames[j]);
+		}
+		if(slot->truncated){
+			used += (size_t)snprintf(folded + used, capacity - used, "%s...", used > 0 ? ";" : "");
+		}
+		appendFrame(folded, used, capacity, source, lines, codeLen, frames[slot->depth - 1]);
+
+		into->samples += slot->count;
+		addStack(into, folded, slot->count);
+	}
+}
+
+int profileWrite(const Profile *profile, const char *path){
+	FILE *file = fopen(path, "w");
+	if(file == NULL){
+		return 0;	// false
+	}
+
+	for(size_t i = 0; i < profile->stackCount; i++){
+		fprintf(file, "%s %llu\n", profile->stacks[i].folded, (unsigned long long)profile->stacks[i].count);
+	}
+	if(profile->dropped > 0){
+		fprintf(stderr, "[Profile]: %llu samples were dropped, the program had more distinct stacks than could be kept.\n",
+		    (unsigned long long)profile->dropped);
+	}
+
+	return fclose(file) == 0;
+}
@@ -0,0 +1,293 @@
+#include "program.h"
+#include "compiler.h"
+#include "device.h"
+#include "idiom.h"
+#include "verify.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// layout of a saved image, all values are in host byte order
+// header, code words (padded to 4 bytes), line numbers, data runs, data words (padded to 4 bytes), start state
+typedef struct ImageHeader{
+	char magic[4];
+	uint32_t version;
+	uint32_t codeLen;
+	uint32_t runCount;
+	uint32_t dataLen;	// words over every run
+	uint32_t startSize;	// 0 when the program runs from the beginning
+} ImageHeader;
+
+// code and data are padded so whatever comes after them stays 4 byte aligned
+static size_t paddedBytes(size_t words){
+	return (sizeof(BITSIZE) * words + 3) & ~(size_t)3;
+}
+
+// for reporting image errors, exits like the other file errors
+static void programError(const char *path, const char *message){
+	fprintf(stderr, "[Program][%s]: %s\n", path, message);
+	exit(74);
+}
+
+// refuses to hand out a program whose code could send the VM somewhere it shouldn't go, objects and images can come from anywhere
+static void requireVerified(const Program *program, const char *path){
+	VerifyError error;
+	if(!verifyCode(program->code, program->codeLen, &error)){
+		fprintf(stderr, "[Program][%s]: %s at 0x%04zX\n", path, error.message, error.pc);
+		exit(74);
+	}
+}
+
+// only once the code is known to be good, the folding trusts every jump in it
+static void foldIdioms(Program *program){
+	BITSIZE *folded = idiomFold(program->code, program->codeLen);
+	program->runCode = folded != NULL ? folded : program->code;
+}
+
+// makes one block that is not owned by the gc, so it can outlive it and cross threads
+static Program *programBuild(const BITSIZE *sourceCode, const uint32_t *sourceLines, size_t codeLen, const DataRun *sourceRuns, size_t runCount, const BITSIZE *sourceData, const ProgramStart *sourceStart, size_t startSize){
+	size_t dataLen = 0;
+	for(size_t i = 0; i < runCount; i++){
+		dataLen += sourceRuns[i].len;
+	}
+
+	size_t codeSize = paddedBytes(codeLen);
+	size_t lineSize = sizeof(uint32_t) * codeLen;
+	size_t runSize = sizeof(DataRun) * runCount;
+	size_t dataSize = paddedBytes(dataLen);
+	Program *program = malloc(sizeof(Program) + codeSize + lineSize + runSize + dataSize + startSize);
+	if(program == NULL){
+		fprintf(stderr, "Not enough memory for program.\n");
+		exit(74);
+	}
+
+	// code, lines, runs, data and the start state sit right after the struct
+	BITSIZE *code = (BITSIZE *)(program + 1);
+	uint32_t *lines = (uint32_t *)((char *)code + codeSize);
+	DataRun *runs = (DataRun *)(lines + codeLen);
+	BITSIZE *data = (BITSIZE *)(runs + runCount);
+	ProgramStart *start = startSize > 0 ? (ProgramStart *)((char *)data + dataSize) : NULL;
+	if(codeLen > 0){
+		memcpy(code, sourceCode, sizeof(BITSIZE) * codeLen);
+		memcpy(lines, sourceLines, lineSize);
+	}
+	if(runCount > 0){
+		memcpy(runs, sourceRuns, runSize);
+	}
+	if(dataLen > 0){
+		memcpy(data, sourceData, sizeof(BITSIZE) * dataLen);
+	}
+	if(start != NULL){
+		memcpy(start, sourceStart, startSize);
+	}
+
+	program->code = code;
+	program->runCode = code;
+	program->codeLen = codeLen;
+	program->lines = lines;
+	program->runs = runs;
+	program->runCount = runCount;
+	program->data = data;
+	program->dataLen = dataLen;
+	program->start = start;
+	program->startSize = startSize;
+	atomic_init(&program->refCount, 1);
+	program->mapping = NULL;
+	program->mappingSize = 0;
+
+	return program;
+}
+
+// copies compiled bytecode out of the gc
+Program *programCreate(const Bytecode *bytecode){
+	if(bytecode == NULL){
+		return NULL;
+	}
+
+	// compiled data is one run, the gaps .org leaves inside it are written as 0
+	DataRun run = {(uint32_t)bytecode->dataBase, (uint32_t)(bytecode->dataEnd - bytecode->dataBase)};
+	Program *program = programBuild(bytecode->code, bytecode->lines, bytecode->codeLen, &run, run.len > 0 ? 1 : 0,
+	    bytecode->data != NULL ? bytecode->data + bytecode->dataBase : NULL, NULL, 0);
+	requireVerified(program, "compiled");
+	foldIdioms(program);
+
+	return program;
+}
+
+// the same code with new initial memory and a start state, the code was already verified
+Program *programWithStart(const Program *program, const DataRun *runs, size_t runCount, const BITSIZE *data, const ProgramStart *start){
+	Program *started = programBuild(program->code, program->lines, program->codeLen, runs, runCount, data, start, sizeof(ProgramStart) + start->outputLen);
+	foldIdioms(started);
+
+	return started;
+}
+
+// maps a saved image read only, every process mapping the same file shares the same pages
+Program *programLoad(const char *path){
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		programError(path, "Could not open image");
+	}
+
+	struct stat info;
+	if(fstat(fd, &info) != 0){
+		programError(path, "Could not read image size");
+	}
+
+	// the header has to be there and agree with the size of the file
+	size_t size = (size_t)info.st_size;
+	if(size < sizeof(ImageHeader)){
+		programError(path, "Image is too small");
+	}
+
+	void *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);	// the mapping stays valid without the descriptor
+	if(mapping == MAP_FAILED){
+		programError(path, "Could not map image");
+	}
+
+	const ImageHeader *header = mapping;
+	if(memcmp(header->magic, IMAGE_MAGIC, 4) != 0 || header->version != IMAGE_VERSION){
+		programError(path, "Not a lexi image or wrong version");
+	}
+	if(header->codeLen > MAXSIZE || header->runCount > DEVICE_BASE || header->dataLen > DEVICE_BASE){
+		programError(path, "Image is corrupt");
+	}
+	size_t runOffset = sizeof(ImageHeader) + paddedBytes(header->codeLen) + sizeof(uint32_t) * header->codeLen;
+	size_t startOffset = runOffset + sizeof(DataRun) * header->runCount + paddedBytes(header->dataLen);
+	if(startOffset + header->startSize != size){
+		programError(path, "Image is corrupt");
+	}
+
+	// runs go up through memory without touching each other or the device page, and account for every data word
+	const DataRun *runs = (const DataRun *)((const char *)mapping + runOffset);
+	size_t runWords = 0;
+	size_t runEnd = 0;
+	for(size_t i = 0; i < header->runCount; i++){
+		if(runs[i].base < runEnd || (size_t)runs[i].base + runs[i].len > DEVICE_BASE){
+			programError(path, "Image is corrupt");
+		}
+		runEnd = (size_t)runs[i].base + runs[i].len;
+		runWords += runs[i].len;
+	}
+	if(runWords != header->dataLen){
+		programError(path, "Image is corrupt");
+	}
+	const ProgramStart *start = header->startSize > 0 ? (const ProgramStart *)((const char *)mapping + startOffset) : NULL;
+	if(start != NULL && (header->startSize < sizeof(ProgramStart) || header->startSize != sizeof(ProgramStart) + start->outputLen)){
+		programError(path, "Image is corrupt");
+	}
+
+	Program *program = malloc(sizeof(Program));
+	if(program == NULL){
+		fprintf(stderr, "Not enough memory for program.\n");
+		exit(74);
+	}
+
+	// point straight into the mapping, nothing gets copied
+	const char *body = (const char *)(header + 1);
+	program->code = (const BITSIZE *)body;
+	program->runCode = program->code;
+	program->codeLen = header->codeLen;
+	program->lines = (const uint32_t *)(body + paddedBytes(header->codeLen));
+	program->runs = runs;
+	program->runCount = header->runCount;
+	program->data = (const BITSIZE *)(runs + header->runCount);
+	program->dataLen = header->dataLen;
+	program->start = start;
+	program->startSize = header->startSize;
+	atomic_init(&program->refCount, 1);
+	program->mapping = mapping;
+	program->mappingSize = size;
+	requireVerified(program, path);
+
+	// the start state is held to the same rules as the code, a VM picking it up would trust it just as much
+	if(start != NULL && (!verifyTarget(program->code, program->codeLen, start->registers[REG_PC]) || start->stackCount > MAXSIZE)){
+		programError(path, "Image start state is corrupt");
+	}
+	foldIdioms(program);
+
+	return program;
+}
+
+// checks the first bytes of a file for the image magic, returns 0 for anything else (like source files)
+int programIsImage(const char *path){
+	FILE *file = fopen(path, "rb");
+	if(file == NULL){
+		return 0;	// false, let the parser report the missing file
+	}
+
+	char magic[4];
+	int isImage = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, IMAGE_MAGIC, 4) == 0;
+	fclose(file);
+
+	return isImage;
+}
+
+// writes the program out so it can be mapped by programLoad later, returns 0 on failure
+int programSave(const Program *program, const char *path){
+	FILE *file = fopen(path, "wb");
+	if(file == NULL){
+		return 0;	// false
+	}
+
+	ImageHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, IMAGE_MAGIC, 4);
+	header.version = IMAGE_VERSION;
+	header.codeLen = (uint32_t)program->codeLen;
+	header.runCount = (uint32_t)program->runCount;
+	header.dataLen = (uint32_t)program->dataLen;
+	header.startSize = (uint32_t)program->startSize;
+
+	// write everything and pad the code and data out to what comes after them
+	static const char padding[4] = {0};
+	size_t codePad = paddedBytes(program->codeLen) - sizeof(BITSIZE) * program->codeLen;
+	size_t dataPad = paddedBytes(program->dataLen) - sizeof(BITSIZE) * program->dataLen;
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+	    fwrite(program->code, sizeof(BITSIZE), program->codeLen, file) == program->codeLen &&
+	    fwrite(padding, 1, codePad, file) == codePad &&
+	    fwrite(program->lines, sizeof(uint32_t), program->codeLen, file) == program->codeLen &&
+	    fwrite(program->runs, sizeof(DataRun), program->runCount, file) == program->runCount &&
+	    fwrite(program->data, sizeof(BITSIZE), program->dataLen, file) == program->dataLen &&
+	    fwrite(padding, 1, dataPad, file) == dataPad &&
+	    (program->start == NULL || fwrite(program->start, 1, program->startSize, file) == program->startSize);
+
+	if(fclose(file) != 0){
+		ok = 0;
+	}
+
+	return ok;
+}
+
+// takes another reference, safe from any thread
+Program *programRetain(Program *program){
+	if(program != NULL){
+		atomic_fetch_add_explicit(&program->refCount, 1, memory_order_relaxed);
+	}
+
+	return program;
+}
+
+// drops a reference, the last one frees the program (or unmaps the image)
+void programRelease(Program *program){
+	if(program == NULL){
+		return;
+	}
+	if(atomic_fetch_sub_explicit(&program->refCount, 1, memory_order_acq_rel) != 1){
+		return;	// still in use somewhere
+	}
+
+	if(program->runCode != program->code){
+		free((BITSIZE *)program->runCode);
+	}
+	if(program->mapping != NULL){
+		munmap(program->mapping, program->mappingSize);
+	}
+	free(program);
+}
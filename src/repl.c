@@ -0,0 +1,149 @@
+#include "repl.h"
+#include "compiler.h"
+#include "main.h"
+#include "parser.h"
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// names for printing registers, indexed by the Registers enum
+static const char *registerNames[] = {
+	"R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "SP", "PC", "ACC"
+};
+
+// runs whatever has been added since the last run, ranTo is where the code ended back then
+static void runSession(Assembler *assembler, VM *vm, size_t *ranTo){
+	size_t pending = assemblerPending(assembler);
+	if(pending > 0){	// a jump would go to address 0 so wait for its label
+		printf("(waiting on %zu label%s)\n", pending, pending == 1 ? "" : "s");
+		return;
+	}
+
+	// the code may have moved while growing so point the VM at it again
+	Bytecode *bytecode = assemblerBytecode(assembler);
+	vmAttachCode(vm, bytecode->code, bytecode->lines, bytecode->codeLen);
+
+	// normally the VM is already parked there, after HLT or an error the new code still runs
+	vm->registers[REG_PC] = (BITSIZE)*ranTo;
+	vm->running = 1;
+	*ranTo = bytecode->codeLen;
+	vmExecute(vm);	// errors are already reported, the session just carries on
+	fflush(stdout);
+}
+
+// data directives take effect straight away, only what the last line wrote is copied so the rest of memory is left alone
+static void loadFedData(const Assembler *assembler, VM *vm){
+	const Bytecode *bytecode = assemblerBytecode(assembler);
+	size_t count = assembler->fedDataEnd - assembler->fedDataBase;
+	if(!vmLoadData(vm, assembler->fedDataBase, bytecode->data + assembler->fedDataBase, count)){
+		fprintf(stderr, "[REPL]: Data at 0x%04zX + 0x%zX overlaps the mapped file, it wasn't loaded\n", assembler->fedDataBase, count);
+	}
+}
+
+void replPrintRegisters(const VM *vm){
+	for(int i = 0; i <= REG_ACC; i++){
+		printf("%s=%04X%s", registerNames[i], vm->registers[i], i == REG_ACC ? "\n" : " ");
+	}
+}
+
+void replPrintMemory(const VM *vm, const char *args){
+	char *end = NULL;
+	unsigned long addr = strtoul(args, &end, 0);
+	unsigned long count = strtoul(end, NULL, 0);
+	if(end == args || addr >= MAXSIZE){
+		printf("usage: :mem <addr> [count]\n");
+		return;
+	}
+	if(count == 0){
+		count = 1;
+	}
+
+	// 8 words to a row
+	for(unsigned long i = 0; i < count && addr + i < MAXSIZE; i++){
+		if(i % 8 == 0){
+			printf("%s%04lX:", i == 0 ? "" : "\n", addr + i);
+		}
+		printf(" %04X", vm->memory[addr + i]);
+	}
+	putchar('\n');
+}
+
+// handles lines starting with ':', returns 0 when the session should end
+static int command(const char *line, const VM *vm){
+	if(strncmp(line, ":q", 2) == 0){
+		return 0;
+	}
+	if(strncmp(line, ":regs", 5) == 0){
+		replPrintRegisters(vm);
+	}
+	else if(strncmp(line, ":mem", 4) == 0){
+		replPrintMemory(vm, line + 4);
+	}
+	else{
+		printf("commands: :regs, :mem <addr> [count], :quit\n");
+	}
+
+	return 1;
+}
+
+// assembles and runs one line at a time, state carries over between lines
+// preloadPath is an optional file assembled and run before the first prompt
+int repl(const char *preloadPath, const VMOptions *options){
+	Assembler *assembler = assemblerCreate();
+	VM *vm = vmCreate(NULL, options);
+	size_t line = 1;	// session line numbers carry on from the preloaded file
+	size_t ranTo = 0;
+
+	if(preloadPath != NULL){
+		Token *tokens = parser((char *)preloadPath);
+		if(!assemblerFeed(assembler, tokens)){
+			vmDestroy(vm);
+			return -1;	// the error has been reported
+		}
+
+		// the end token sits on the last line of the file
+		size_t index = 0;
+		while(tokens[index].type != TOKEN_END){
+			index++;
+		}
+		line = tokens[index].line + 1;
+
+		loadFedData(assembler, vm);
+		runSession(assembler, vm, &ranTo);
+	}
+
+	int interactive = isatty(STDIN_FILENO);
+	char *input = NULL;
+	size_t inputSize = 0;
+	while(1){
+		if(interactive){
+			printf("> ");
+			fflush(stdout);
+		}
+		if(getline(&input, &inputSize, stdin) < 0){
+			break;	// end of input
+		}
+
+		if(input[0] == ':'){
+			if(!command(input, vm)){
+				break;
+			}
+			continue;
+		}
+
+		// only this line gets tokenized and compiled, errors just skip it
+		Token *tokens = parserString(input, line++);
+		if(tokens != NULL && assemblerFeed(assembler, tokens)){
+			loadFedData(assembler, vm);
+			runSession(assembler, vm, &ranTo);
+		}
+	}
+
+	free(input);	// made by getline with malloc
+	vmDestroy(vm);
+
+	return 0;
+}
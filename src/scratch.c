@@ -0,0 +1,105 @@
+#include "scratch.h"
+#include "main.h"
+
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// every allocation starts on a boundary anything can sit on
+#define SCRATCH_ALIGN alignof(max_align_t)
+
+static _Thread_local Scratch *activeScratch = NULL;
+
+static size_t alignUp(size_t size){
+	return (size + SCRATCH_ALIGN - 1) & ~(SCRATCH_ALIGN - 1);
+}
+
+// the header is padded so the first allocation in a chunk is aligned too
+static unsigned char *chunkMemory(ScratchChunk *chunk){
+	return (unsigned char *)chunk + alignUp(sizeof(ScratchChunk));
+}
+
+Scratch *scratchBegin(void){
+	// using malloc since the point is to keep all of this away from the gc
+	Scratch *scratch = calloc(1, sizeof(Scratch));
+	if(scratch == NULL){
+		fprintf(stderr, "Not enough memory to compile.\n");
+		exit(74);
+	}
+	scratch->outer = activeScratch;
+	activeScratch = scratch;
+
+	return scratch;
+}
+
+void scratchEnd(Scratch *scratch){
+	if(scratch == NULL){
+		return;
+	}
+
+	activeScratch = scratch->outer;
+	ScratchChunk *chunk = scratch->chunks;
+	while(chunk != NULL){
+		ScratchChunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	free(scratch);
+}
+
+size_t scratchUsed(const Scratch *scratch){
+	return scratch->used;
+}
+
+void *scratchAlloc(size_t size){
+	Scratch *scratch = activeScratch;
+	if(scratch == NULL){
+		return gcAlloc(size);
+	}
+
+	size = alignUp(size > 0 ? size : 1);
+	ScratchChunk *chunk = scratch->chunks;
+	if(chunk == NULL || chunk->size - chunk->used < size){
+		// calloc hands back zeroed memory and nothing in a chunk is ever reused, so every allocation starts out as 0
+		size_t chunkSize = size > SCRATCH_CHUNK ? size : SCRATCH_CHUNK;
+		chunk = calloc(1, alignUp(sizeof(ScratchChunk)) + chunkSize);
+		if(chunk == NULL){
+			fprintf(stderr, "Not enough memory to compile.\n");
+			exit(74);
+		}
+		chunk->size = chunkSize;
+		chunk->next = scratch->chunks;
+		scratch->chunks = chunk;
+		scratch->reserved += chunkSize;
+	}
+
+	void *memory = chunkMemory(chunk) + chunk->used;
+	chunk->used += size;
+	scratch->used += size;
+	scratch->last = memory;
+	scratch->lastSize = size;
+
+	return memory;
+}
+
+void *scratchGrow(void *memory, size_t oldSize, size_t newSize){
+	Scratch *scratch = activeScratch;
+	if(memory != NULL && scratch != NULL && memory == scratch->last){
+		ScratchChunk *chunk = scratch->chunks;
+		size_t grown = alignUp(newSize);
+		if(grown >= scratch->lastSize && grown - scratch->lastSize <= chunk->size - chunk->used){
+			chunk->used += grown - scratch->lastSize;
+			scratch->used += grown - scratch->lastSize;
+			scratch->lastSize = grown;
+			return memory;
+		}
+	}
+
+	void *grown = scratchAlloc(newSize);
+	if(memory != NULL && oldSize > 0){
+		memcpy(grown, memory, oldSize < newSize ? oldSize : newSize);
+	}
+
+	return grown;
+}
@@ -0,0 +1,534 @@
+#define _GNU_SOURCE	// accept4
+#include "serve.h"
+#include "linker.h"
+#include "program.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// one connection whose run hasn't finished yet
+typedef struct ServeRun{
+	pid_t pid;
+	int fd;
+} ServeRun;
+
+// filled in by the server, forked runs get a copy and find their programs here
+static ServeEntry cache[SERVE_CACHE_SIZE];
+static size_t cacheCount = 0;
+static size_t cacheNext = 0;	// slot the next program goes in once the cache is full
+
+static int socketAddress(const char *socketPath, struct sockaddr_un *address){
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if(strlen(socketPath) >= sizeof(address->sun_path)){
+		fprintf(stderr, "[Serve]: Socket path \"%s\" is too long.\n", socketPath);
+		return 0;
+	}
+	strcpy(address->sun_path, socketPath);
+
+	return 1;
+}
+
+// loops until every byte is written, or gives up
+static int writeAll(int fd, const void *buffer, size_t size){
+	const char *cursor = buffer;
+	while(size > 0){
+		ssize_t written = write(fd, cursor, size);
+		if(written < 0 && errno == EINTR){
+			continue;
+		}
+		if(written <= 0){
+			return 0;
+		}
+		cursor += written;
+		size -= (size_t)written;
+	}
+
+	return 1;
+}
+
+static int readAll(int fd, void *buffer, size_t size){
+	char *cursor = buffer;
+	while(size > 0){
+		ssize_t bytesRead = read(fd, cursor, size);
+		if(bytesRead < 0 && errno == EINTR){
+			continue;
+		}
+		if(bytesRead <= 0){
+			return 0;
+		}
+		cursor += bytesRead;
+		size -= (size_t)bytesRead;
+	}
+
+	return 1;
+}
+
+static int sameFile(const ServeEntry *entry, const struct stat *info){
+	return entry->device == info->st_dev && entry->inode == info->st_ino && entry->size == info->st_size &&
+	    entry->modified.tv_sec == info->st_mtim.tv_sec && entry->modified.tv_nsec == info->st_mtim.tv_nsec;
+}
+
+// finds the entry for an absolute path whether or not it's stale
+static ServeEntry *cacheEntry(const char *resolved){
+	for(size_t i = 0; i < cacheCount; i++){
+		if(strcmp(cache[i].path, resolved) == 0){
+			return &cache[i];
+		}
+	}
+
+	return NULL;
+}
+
+Program *serveCacheFind(const char *path){
+	if(cacheCount == 0){
+		return NULL;	// not running under a server
+	}
+
+	char resolved[PATH_MAX];
+	struct stat info;
+	if(realpath(path, resolved) == NULL || stat(resolved, &info) != 0){
+		return NULL;
+	}
+
+	ServeEntry *entry = cacheEntry(resolved);
+	if(entry == NULL || !sameFile(entry, &info)){
+		return NULL;
+	}
+
+	return programRetain(entry->program);
+}
+
+// compiles a source file in a child and keeps the image, returns the child's exit code
+// the child writes its errors to the client so they look the same as a normal run
+// the server waits for it, so other clients are held up while a cold program compiles (only the first run of each pays)
+static int cacheWarm(const char *resolved, const struct stat *info, int errorFd, ServeCompile compile){
+	ServeEntry *entry = cacheEntry(resolved);
+	if(entry != NULL && sameFile(entry, info)){
+		return 0;	// already warm
+	}
+
+	char imagePath[] = "/tmp/lexi-serve-XXXXXX";
+	int imageFd = mkstemp(imagePath);
+	if(imageFd < 0){
+		return 0;	// no cache this time, the run compiles it itself
+	}
+	close(imageFd);
+
+	fflush(NULL);
+	pid_t pid = fork();
+	if(pid == 0){
+		dup2(errorFd, STDERR_FILENO);
+		exit(compile(resolved, imagePath));
+	}
+
+	int status = 0;
+	while(pid > 0 && waitpid(pid, &status, 0) < 0 && errno == EINTR){
+	}
+	if(pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+		unlink(imagePath);
+		return pid < 0 ? 0 : (WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+	}
+
+	// the mapping stays valid after the file is gone
+	Program *program = programLoad(imagePath);
+	unlink(imagePath);
+
+	if(entry == NULL){
+		if(cacheCount < SERVE_CACHE_SIZE){
+			entry = &cache[cacheCount++];
+		}
+		else{
+			entry = &cache[cacheNext];
+			cacheNext = (cacheNext + 1) % SERVE_CACHE_SIZE;
+			free(entry->path);
+			programRelease(entry->program);
+		}
+		entry->path = strdup(resolved);
+		if(entry->path == NULL){
+			fprintf(stderr, "Not enough memory for the program cache.\n");
+			exit(74);
+		}
+	}
+	else{
+		programRelease(entry->program);
+	}
+	entry->device = info->st_dev;
+	entry->inode = info->st_ino;
+	entry->size = info->st_size;
+	entry->modified = info->st_mtim;
+	entry->program = program;
+
+	return 0;
+}
+
+// warms every program the command is going to load on its own, files that get linked together can't be compiled alone
+static int cacheWarmCommand(const char *cwd, int argc, char **argv, int errorFd, ServeCompile compile){
+	const char *paths[SERVE_CACHE_SIZE];
+	int pathCount = 0;
+	int separate = 0;	// --batch and --pipeline load every file by itself
+	for(int i = 0; i < argc; i++){
+		if(strcmp(argv[i], "-o") == 0){
+			i++;	// the output, not an input
+		}
+		else if(strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--repl") == 0){
+			return 0;	// objects and the REPL never use the cache
+		}
+		else if(strcmp(argv[i], "--batch") == 0 || strcmp(argv[i], "--pipeline") == 0){
+			separate = 1;
+		}
+		else if(argv[i][0] != '-' && pathCount < SERVE_CACHE_SIZE){
+			paths[pathCount++] = argv[i];
+		}
+	}
+	if(pathCount > 1 && !separate){
+		return 0;
+	}
+
+	for(int i = 0; i < pathCount; i++){
+		char joined[PATH_MAX];
+		char resolved[PATH_MAX];
+		struct stat info;
+		if(paths[i][0] == '/'){
+			snprintf(joined, sizeof(joined), "%s", paths[i]);
+		}
+		else{
+			snprintf(joined, sizeof(joined), "%s/%s", cwd, paths[i]);
+		}
+
+		// missing files, images and objects are left for the run to deal with
+		if(realpath(joined, resolved) == NULL || stat(resolved, &info) != 0 || !S_ISREG(info.st_mode) ||
+		    programIsImage(resolved) || objectIsObject(resolved)){
+			continue;
+		}
+
+		int status = cacheWarm(resolved, &info, errorFd, compile);
+		if(status != 0){
+			return status;
+		}
+	}
+
+	return 0;
+}
+
+static void reply(int fd, int status){
+	ServeReply message = {SERVE_MAGIC, status};
+	writeAll(fd, &message, sizeof(message));
+}
+
+// reads a request and the three descriptors that come with it, returns 0 if it is malformed
+static int receiveRequest(int fd, ServeRequest *request, int fds[3], char **payload){
+	struct iovec part = {request, sizeof(ServeRequest)};
+	char control[CMSG_SPACE(sizeof(int) * 3)];
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &part;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+	ssize_t received = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+	if(received < 0){
+		return 0;	// nothing arrived, not even descriptors
+	}
+
+	// whatever descriptors came are ours now, anything short of exactly 3 gets closed again so a bad client can't leak them
+	// the control buffer only has room for 3, the kernel closes any past that itself
+	int count = 0;
+	for(struct cmsghdr *header = CMSG_FIRSTHDR(&message); header != NULL; header = CMSG_NXTHDR(&message, header)){
+		if(header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS){
+			continue;
+		}
+		size_t carried = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for(size_t i = 0; i < carried; i++){
+			int descriptor;
+			memcpy(&descriptor, CMSG_DATA(header) + sizeof(int) * i, sizeof(int));
+			if(count < 3){
+				fds[count++] = descriptor;
+			}
+			else{
+				close(descriptor);
+			}
+		}
+	}
+	if(received == 0 || count != 3){
+		for(int i = 0; i < count; i++){
+			close(fds[i]);
+		}
+		return 0;
+	}
+
+	// the rest of the header can trail behind the descriptors
+	if(!readAll(fd, (char *)request + received, sizeof(ServeRequest) - (size_t)received) ||
+	    request->magic != SERVE_MAGIC || request->length == 0 || request->length > SERVE_MAX_REQUEST){
+		close(fds[0]);
+		close(fds[1]);
+		close(fds[2]);
+		return 0;
+	}
+
+	*payload = malloc(request->length);
+	if(*payload == NULL || !readAll(fd, *payload, request->length) || (*payload)[request->length - 1] != '\0'){
+		free(*payload);
+		close(fds[0]);
+		close(fds[1]);
+		close(fds[2]);
+		return 0;
+	}
+
+	return 1;
+}
+
+// splits the payload into the cwd and an argv with the program name in front, returns 0 if the counts don't match
+static int splitPayload(char *payload, uint32_t length, uint32_t argc, char ***argv){
+	*argv = malloc(sizeof(char *) * ((size_t)argc + 2));
+	if(*argv == NULL){
+		fprintf(stderr, "Not enough memory for a request.\n");
+		exit(74);
+	}
+
+	(*argv)[0] = "lexi-lang";
+	size_t offset = strlen(payload) + 1;	// skip the cwd
+	for(uint32_t i = 0; i < argc; i++){
+		if(offset >= length){
+			return 0;
+		}
+		(*argv)[i + 1] = payload + offset;
+		offset += strlen(payload + offset) + 1;
+	}
+	(*argv)[argc + 1] = NULL;
+
+	return offset == length;
+}
+
+// starts one run, the connection stays open in the server so the exit code can be sent once the child is reaped
+static pid_t startRun(int connection, ServeCommand command, ServeCompile compile, int closeFds[2]){
+	ServeRequest request;
+	int fds[3];
+	char *payload = NULL;
+	if(!receiveRequest(connection, &request, fds, &payload)){
+		return -1;
+	}
+
+	char **argv = NULL;
+	pid_t pid = -1;
+	if(splitPayload(payload, request.length, request.argc, &argv)){
+		int status = cacheWarmCommand(payload, (int)request.argc, argv + 1, fds[2], compile);
+		if(status != 0){
+			reply(connection, status);	// the compile error is already on the client's stderr
+			pid = 0;
+		}
+		else{
+			fflush(NULL);
+			pid = fork();
+		}
+		if(pid == 0 && status == 0){
+			// the child becomes the command, with the client's descriptors and directory
+			close(closeFds[0]);
+			close(closeFds[1]);
+			close(connection);
+			dup2(fds[0], STDIN_FILENO);
+			dup2(fds[1], STDOUT_FILENO);
+			dup2(fds[2], STDERR_FILENO);
+			sigset_t signals;
+			sigemptyset(&signals);
+			sigprocmask(SIG_SETMASK, &signals, NULL);
+			signal(SIGPIPE, SIG_DFL);	// back to dying like a normal run would
+			if(chdir(payload) != 0){
+				fprintf(stderr, "[Serve]: Could not change to \"%s\".\n", payload);
+				exit(74);
+			}
+			exit(command((int)request.argc + 1, argv));
+		}
+	}
+
+	free(argv);
+	free(payload);
+	close(fds[0]);
+	close(fds[1]);
+	close(fds[2]);
+
+	return pid;
+}
+
+int serveRun(const char *socketPath, ServeCommand command, ServeCompile compile){
+	struct sockaddr_un address;
+	if(!socketAddress(socketPath, &address)){
+		return 74;
+	}
+
+	// a socket nobody answers on is left over from a server that died, one that answers belongs to a live one
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(listener >= 0 && connect(listener, (struct sockaddr *)&address, sizeof(address)) == 0){
+		fprintf(stderr, "[Serve]: Another server is already using \"%s\".\n", socketPath);
+		close(listener);
+		return 74;
+	}
+	if(listener >= 0){
+		close(listener);
+	}
+	unlink(socketPath);
+
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0){
+		fprintf(stderr, "[Serve]: Could not listen on \"%s\": %s\n", socketPath, strerror(errno));
+		return 74;
+	}
+
+	// finished runs show up on a descriptor so one poll covers both
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &signals, NULL);
+	int childFd = signalfd(-1, &signals, SFD_CLOEXEC);
+	signal(SIGPIPE, SIG_IGN);	// a client that went away shouldn't take the server with it
+
+	// using malloc since it lives as long as the server
+	size_t runCount = 0;
+	size_t runCapacity = 16;
+	ServeRun *runs = malloc(sizeof(ServeRun) * runCapacity);
+	if(childFd < 0 || runs == NULL){
+		fprintf(stderr, "[Serve]: Could not set up the server.\n");
+		return 74;
+	}
+
+	fprintf(stderr, "[Serve]: Listening on \"%s\".\n", socketPath);
+	for(;;){
+		struct pollfd waits[2] = {{listener, POLLIN, 0}, {childFd, POLLIN, 0}};
+		if(poll(waits, 2, -1) < 0){
+			continue;	// interrupted
+		}
+
+		if(waits[1].revents & POLLIN){
+			struct signalfd_siginfo info;
+			while(read(childFd, &info, sizeof(info)) < 0 && errno == EINTR){
+			}
+
+			// one signal can stand for any number of children
+			int status;
+			pid_t pid;
+			while((pid = waitpid(-1, &status, WNOHANG)) > 0){
+				for(size_t i = 0; i < runCount; i++){
+					if(runs[i].pid == pid){
+						reply(runs[i].fd, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+						close(runs[i].fd);
+						runs[i] = runs[--runCount];
+						break;
+					}
+				}
+			}
+		}
+
+		if(waits[0].revents & POLLIN){
+			int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+			if(connection < 0){
+				continue;
+			}
+
+			// a client that stalls halfway through its request can't hold up everyone else for long
+			struct timeval timeout = {5, 0};
+			setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+			int closeFds[2] = {listener, childFd};
+			pid_t pid = startRun(connection, command, compile, closeFds);
+			if(pid <= 0){
+				close(connection);	// malformed, or answered already
+				continue;
+			}
+
+			if(runCount == runCapacity){
+				runCapacity *= 2;
+				runs = realloc(runs, sizeof(ServeRun) * runCapacity);
+				if(runs == NULL){
+					fprintf(stderr, "Not enough memory for the server.\n");
+					exit(74);
+				}
+			}
+			runs[runCount++] = (ServeRun){pid, connection};
+		}
+	}
+}
+
+int serveClient(const char *socketPath, int argc, char **argv){
+	struct sockaddr_un address;
+	if(!socketAddress(socketPath, &address)){
+		return 74;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0){
+		fprintf(stderr, "[Serve]: Could not reach a server on \"%s\": %s\n", socketPath, strerror(errno));
+		return 74;
+	}
+
+	// relative paths in the arguments are resolved against this directory on the other side
+	char cwd[PATH_MAX];
+	if(getcwd(cwd, sizeof(cwd)) == NULL){
+		fprintf(stderr, "[Serve]: Could not read the current directory.\n");
+		return 74;
+	}
+
+	size_t length = strlen(cwd) + 1;
+	for(int i = 0; i < argc; i++){
+		length += strlen(argv[i]) + 1;
+	}
+	if(length > SERVE_MAX_REQUEST){
+		fprintf(stderr, "[Serve]: Command line is too long.\n");
+		return 74;
+	}
+
+	char *payload = malloc(length);
+	if(payload == NULL){
+		fprintf(stderr, "Not enough memory for a request.\n");
+		return 74;
+	}
+	size_t offset = 0;
+	memcpy(payload, cwd, strlen(cwd) + 1);
+	offset += strlen(cwd) + 1;
+	for(int i = 0; i < argc; i++){
+		memcpy(payload + offset, argv[i], strlen(argv[i]) + 1);
+		offset += strlen(argv[i]) + 1;
+	}
+
+	// the header carries our stdin, stdout and stderr so the run reads and writes them directly
+	ServeRequest request = {SERVE_MAGIC, (uint32_t)length, (uint32_t)argc};
+	int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+	struct iovec part = {&request, sizeof(request)};
+	char control[CMSG_SPACE(sizeof(fds))];
+	memset(control, 0, sizeof(control));
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &part;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+	ssize_t sent = sendmsg(fd, &message, 0);
+	int ok = sent >= 0 && writeAll(fd, (char *)&request + sent, sizeof(request) - (size_t)sent) && writeAll(fd, payload, length);
+	free(payload);
+
+	ServeReply answer;
+	if(!ok || !readAll(fd, &answer, sizeof(answer)) || answer.magic != SERVE_MAGIC){
+		fprintf(stderr, "[Serve]: The server hung up before the run finished.\n");
+		close(fd);
+		return 74;
+	}
+	close(fd);
+
+	return answer.status;
+}
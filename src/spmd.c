@@ -0,0 +1,271 @@
+#define _GNU_SOURCE	// memfd_create
+#include "spmd.h"
+#include "channel.h"
+#include "program.h"
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// one per core, the thread only touches its own
+typedef struct Worker{
+	pthread_t thread;
+	VM *vm;
+	Barrier *barrier;
+	char *tracePath;	// every core dumps its own trace
+	int result;
+} Worker;
+
+static void barrierInit(Barrier *barrier, size_t members){
+	pthread_mutex_init(&barrier->lock, NULL);
+	pthread_cond_init(&barrier->released, NULL);
+	barrier->members = members;
+	barrier->waiting = 0;
+	barrier->generation = 0;
+}
+
+static void barrierDestroy(Barrier *barrier){
+	pthread_cond_destroy(&barrier->released);
+	pthread_mutex_destroy(&barrier->lock);
+}
+
+// lets everyone waiting go, the lock must be held
+static void barrierOpen(Barrier *barrier){
+	barrier->waiting = 0;
+	barrier->generation++;
+	pthread_cond_broadcast(&barrier->released);
+}
+
+// blocks until every core still running has called this
+void barrierWait(Barrier *barrier){
+	pthread_mutex_lock(&barrier->lock);
+
+	uint64_t generation = barrier->generation;
+	barrier->waiting++;
+	if(barrier->waiting == barrier->members){	// last one in opens it
+		barrierOpen(barrier);
+	}
+	else{
+		while(generation == barrier->generation){
+			pthread_cond_wait(&barrier->released, &barrier->lock);
+		}
+	}
+
+	pthread_mutex_unlock(&barrier->lock);
+}
+
+// a core that stopped no longer counts, if everyone left was already waiting on it they can go
+void barrierLeave(Barrier *barrier){
+	pthread_mutex_lock(&barrier->lock);
+
+	barrier->members--;
+	if(barrier->waiting > 0 && barrier->waiting == barrier->members){
+		barrierOpen(barrier);
+	}
+
+	pthread_mutex_unlock(&barrier->lock);
+}
+
+static void *workerMain(void *argument){
+	Worker *worker = argument;
+	VM *vm = worker->vm;
+
+	worker->result = vmExecute(vm);
+
+	// HLT or an error, either way this core is done and nobody should wait on it
+	if(vm->outbound != NULL){
+		channelClose(vm->outbound);
+	}
+	if(vm->inbound != NULL){
+		channelAbandon(vm->inbound);
+	}
+	barrierLeave(worker->barrier);
+
+	return NULL;
+}
+
+// makes the VM for core index of count, nothing runs until workersRun
+static void workerCreate(Worker *worker, Program *program, const VMOptions *options, size_t index, size_t count, Barrier *barrier){
+	worker->barrier = barrier;
+	worker->vm = vmCreate(program, options);
+	worker->vm->coreId = (BITSIZE)index;
+	worker->vm->coreCount = (BITSIZE)count;
+	worker->vm->barrier = barrier;
+
+	if(worker->vm->trace != NULL){	// "lexi.trace" becomes "lexi.trace.0", "lexi.trace.1", ...
+		size_t length = strlen(worker->vm->tracePath) + 24;
+		worker->tracePath = malloc(length);
+		if(worker->tracePath == NULL){
+			fprintf(stderr, "Not enough memory for trace paths.\n");
+			exit(74);
+		}
+		snprintf(worker->tracePath, length, "%s.%zu", worker->vm->tracePath, index);
+		worker->vm->tracePath = worker->tracePath;
+	}
+}
+
+// starts a thread per worker and waits for every one of them to halt, returns -1 if any stopped on an error
+static int workersRun(Worker *workers, size_t count, Barrier *barrier){
+	int result = 0;
+	size_t started = 0;
+	for(; started < count; started++){
+		if(pthread_create(&workers[started].thread, NULL, workerMain, &workers[started]) != 0){
+			fprintf(stderr, "[SPMD]: Could not start core %zu.\n", started);
+			result = -1;
+			break;
+		}
+	}
+
+	// the cores that never started still count as barrier members and channel ends, stop them holding the rest up
+	for(size_t i = started; i < count; i++){
+		VM *vm = workers[i].vm;
+		if(vm->outbound != NULL){
+			channelClose(vm->outbound);
+		}
+		if(vm->inbound != NULL){
+			channelAbandon(vm->inbound);
+		}
+		barrierLeave(barrier);
+	}
+
+	// HLT on every core is what ends the run
+	for(size_t i = 0; i < started; i++){
+		pthread_join(workers[i].thread, NULL);
+		if(workers[i].result != 0){
+			result = -1;
+		}
+	}
+
+	return result;
+}
+
+// destroyed one at a time so the stats merge and trace dumps don't race
+static void workersDestroy(Worker *workers, size_t count){
+	for(size_t i = 0; i < count; i++){
+		vmDestroy(workers[i].vm);
+		free(workers[i].tracePath);
+	}
+	free(workers);
+}
+
+static Worker *workersCreate(size_t count){
+	// using malloc since it lives for the whole run and the threads must not touch the gc
+	Worker *workers = calloc(count, sizeof(Worker));
+	if(workers == NULL){
+		fprintf(stderr, "Not enough memory for %zu cores.\n", count);
+		exit(74);
+	}
+
+	return workers;
+}
+
+// the shared window is backed by an in memory file so the same pages can be mapped into every core's memory
+static int sharedCreate(size_t words){
+	int fd = memfd_create("lexi-shared", 0);
+	if(fd < 0){
+		return -1;
+	}
+
+	if(ftruncate(fd, (off_t)(words * sizeof(BITSIZE))) != 0){
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int spmdRun(Program *program, const VMOptions *options){
+	if(program == NULL){
+		return -1;
+	}
+
+	size_t cores = options->cores;
+	BITSIZE sharedBase = options->sharedWords > 0 ? options->sharedBase : SPMD_SHARED_BASE;
+	size_t sharedWords = options->sharedWords > 0 ? options->sharedWords : SPMD_SHARED_WORDS;
+
+	// both would be mapped over the same memory and whichever came last would win
+	if(options->mapPath != NULL && sharedBase < options->mapBase + options->mapWords && options->mapBase < sharedBase + sharedWords){
+		fprintf(stderr, "[SPMD]: The shared window 0x%04X + 0x%zX overlaps the mapped file, move one with --shared or --map.\n", sharedBase, sharedWords);
+		return -1;
+	}
+
+	int sharedFd = sharedCreate(sharedWords);
+	if(sharedFd < 0){
+		fprintf(stderr, "[SPMD]: Could not create the shared window.\n");
+		return -1;
+	}
+
+	Worker *workers = workersCreate(cores);
+	Barrier barrier;
+	barrierInit(&barrier, cores);
+
+	// every VM is made up front so a failure doesn't leave half the cores running
+	int result = 0;
+	for(size_t i = 0; i < cores; i++){
+		workerCreate(&workers[i], program, options, i, cores, &barrier);
+
+		if(result == 0 && !vmMapWindow(workers[i].vm, sharedBase, sharedWords, sharedFd, 0, PROT_READ | PROT_WRITE, MAP_SHARED)){
+			fprintf(stderr, "[SPMD]: Shared window 0x%04X + 0x%zX must be page aligned and below the device page.\n", sharedBase, sharedWords);
+			result = -1;
+		}
+
+		// windows go in before data on every path, vmCreate already put the data in so this only sets up the shared window
+		// every core writes the same words so the order doesn't matter, and vmCreate already turned down data over a mapped file
+		vmLoadProgramData(workers[i].vm, program);
+	}
+	close(sharedFd);	// the mappings keep it alive
+
+	if(result == 0){
+		result = workersRun(workers, cores, &barrier);
+	}
+
+	workersDestroy(workers, cores);
+	barrierDestroy(&barrier);
+
+	return result;
+}
+
+int pipelineRun(Program **programs, const char **paths, size_t count, const VMOptions *options){
+	for(size_t i = 0; i < count; i++){
+		if(programs[i] == NULL){
+			return -1;
+		}
+	}
+
+	Worker *workers = workersCreate(count);
+	Channel **channels = calloc(count, sizeof(Channel *));	// channels[i] goes from stage i to stage i + 1
+	if(channels == NULL){
+		fprintf(stderr, "Not enough memory for %zu channels.\n", count);
+		exit(74);
+	}
+	Barrier barrier;
+	barrierInit(&barrier, count);
+
+	for(size_t i = 0; i < count; i++){
+		VMOptions stageOptions = *options;	// each stage is its own program so it gets its own source
+		stageOptions.sourcePath = paths[i];
+		workerCreate(&workers[i], programs[i], &stageOptions, i, count, &barrier);
+
+		if(i + 1 < count){
+			channels[i] = channelCreate();
+			workers[i].vm->outbound = channels[i];
+		}
+		if(i > 0){
+			workers[i].vm->inbound = channels[i - 1];
+		}
+	}
+
+	int result = workersRun(workers, count, &barrier);
+
+	workersDestroy(workers, count);
+	for(size_t i = 0; i < count; i++){
+		channelFree(channels[i]);
+	}
+	free(channels);
+	barrierDestroy(&barrier);
+
+	return result;
+}
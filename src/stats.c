@@ -0,0 +1,194 @@
+#include "stats.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// all of this uses malloc since it lives across several VMs and outside the gc's view
+
+static void *statsAlloc(size_t size){
+	void *memory = calloc(1, size);
+	if(memory == NULL){
+		fprintf(stderr, "Not enough memory for stats.\n");
+		exit(74);
+	}
+
+	return memory;
+}
+
+// makes empty stats for merging runs into
+Stats *statsCreate(void){
+	Stats *stats = statsAlloc(sizeof(Stats));
+	stats->previous = STATS_NO_PREVIOUS;
+
+	return stats;
+}
+
+// adds a zeroed jump table for a program, source and lines are copied since the program may be gone before the stats are written
+static JumpStats *addProgram(Stats *stats, const char *source, const uint32_t *lines, size_t codeLen){
+	JumpStats *programs = realloc(stats->programs, sizeof(JumpStats) * (stats->programCount + 1));
+	if(programs == NULL){
+		fprintf(stderr, "Not enough memory for stats.\n");
+		exit(74);
+	}
+	stats->programs = programs;
+
+	JumpStats *program = &programs[stats->programCount++];
+	program->source = statsAlloc(strlen(source != NULL ? source : "") + 1);
+	strcpy(program->source, source != NULL ? source : "");
+	program->codeLen = codeLen;
+	program->lines = statsAlloc(sizeof(uint32_t) * (codeLen + 1));
+	program->taken = statsAlloc(sizeof(uint64_t) * (codeLen + 1));
+	program->notTaken = statsAlloc(sizeof(uint64_t) * (codeLen + 1));
+	if(lines != NULL && codeLen > 0){
+		memcpy(program->lines, lines, sizeof(uint32_t) * codeLen);
+	}
+
+	return program;
+}
+
+// makes the stats a single VM records into while running a program
+Stats *statsCreateRun(const char *source, const uint32_t *lines, size_t codeLen){
+	Stats *stats = statsCreate();
+	stats->runs = 1;
+	addProgram(stats, source, lines, codeLen);
+
+	return stats;
+}
+
+void statsFree(Stats *stats){
+	if(stats == NULL){
+		return;
+	}
+
+	for(size_t i = 0; i < stats->programCount; i++){
+		free(stats->programs[i].source);
+		free(stats->programs[i].lines);
+		free(stats->programs[i].taken);
+		free(stats->programs[i].notTaken);
+	}
+	free(stats->programs);
+	free(stats);
+}
+
+// the same program run again shares its jump table, matched by source and size
+static JumpStats *findProgram(Stats *stats, const JumpStats *program){
+	for(size_t i = 0; i < stats->programCount; i++){
+		JumpStats *candidate = &stats->programs[i];
+		if(candidate->codeLen == program->codeLen && strcmp(candidate->source, program->source) == 0){
+			return candidate;
+		}
+	}
+
+	return NULL;
+}
+
+// adds every counter in from to into, the high water mark is the larger of the two
+void statsMerge(Stats *into, const Stats *from){
+	into->runs += from->runs;
+	into->instructions += from->instructions;
+	if(from->stackHighWater > into->stackHighWater){
+		into->stackHighWater = from->stackHighWater;
+	}
+	if(from->compileBytes > into->compileBytes){
+		into->compileBytes = from->compileBytes;
+	}
+
+	for(int i = 0; i < STATS_OPCODES; i++){
+		into->opcodes[i] += from->opcodes[i];
+		for(int j = 0; j < STATS_OPCODES; j++){
+			into->bigrams[i][j] += from->bigrams[i][j];
+		}
+	}
+
+	for(size_t i = 0; i < from->programCount; i++){
+		const JumpStats *program = &from->programs[i];
+		JumpStats *target = findProgram(into, program);
+		if(target == NULL){
+			target = addProgram(into, program->source, program->lines, program->codeLen);
+		}
+
+		for(size_t pc = 0; pc < program->codeLen; pc++){
+			target->taken[pc] += program->taken[pc];
+			target->notTaken[pc] += program->notTaken[pc];
+		}
+	}
+}
+
+// writes a string with the characters JSON cares about escaped
+static void writeString(FILE *file, const char *text){
+	fputc('"', file);
+	for(const char *c = text != NULL ? text : ""; *c != '\0'; c++){
+		if(*c == '"' || *c == '\\'){
+			fputc('\\', file);
+			fputc(*c, file);
+		}
+		else if((unsigned char)*c < 0x20){
+			fprintf(file, "\\u%04x", (unsigned)(unsigned char)*c);
+		}
+		else{
+			fputc(*c, file);
+		}
+	}
+	fputc('"', file);
+}
+
+// writes the stats as JSON, only counters that are non zero are included, returns 0 on failure
+int statsWrite(const Stats *stats, const char *path){
+	FILE *file = fopen(path, "w");
+	if(file == NULL){
+		return 0;	// false
+	}
+
+	fprintf(file, "{\n  \"runs\": %llu,\n", (unsigned long long)stats->runs);
+	fprintf(file, "  \"instructions\": %llu,\n", (unsigned long long)stats->instructions);
+	fprintf(file, "  \"stackHighWater\": %llu,\n", (unsigned long long)stats->stackHighWater);
+	fprintf(file, "  \"compileBytes\": %llu,\n", (unsigned long long)stats->compileBytes);
+
+	// opcode counts
+	fprintf(file, "  \"opcodes\": {");
+	const char *separator = "\n";
+	for(unsigned i = 0; i < STATS_OPCODES; i++){
+		if(stats->opcodes[i] == 0){
+			continue;
+		}
+		fprintf(file, "%s    \"%s\": %llu", separator, traceOpcodeName(i), (unsigned long long)stats->opcodes[i]);
+		separator = ",\n";
+	}
+	fprintf(file, "\n  },\n");
+
+	// pairs of opcodes that ran back to back
+	fprintf(file, "  \"bigrams\": {");
+	separator = "\n";
+	for(unsigned i = 0; i < STATS_OPCODES; i++){
+		for(unsigned j = 0; j < STATS_OPCODES; j++){
+			if(stats->bigrams[i][j] == 0){
+				continue;
+			}
+			fprintf(file, "%s    \"%s %s\": %llu", separator, traceOpcodeName(i), traceOpcodeName(j), (unsigned long long)stats->bigrams[i][j]);
+			separator = ",\n";
+		}
+	}
+	fprintf(file, "\n  },\n");
+
+	// every conditional jump that ran at least once
+	fprintf(file, "  \"jumps\": [");
+	separator = "\n";
+	for(size_t i = 0; i < stats->programCount; i++){
+		const JumpStats *program = &stats->programs[i];
+		for(size_t pc = 0; pc < program->codeLen; pc++){
+			if(program->taken[pc] == 0 && program->notTaken[pc] == 0){
+				continue;
+			}
+			fprintf(file, "%s    {\"program\": ", separator);
+			writeString(file, program->source);
+			fprintf(file, ", \"pc\": %zu, \"line\": %u, \"taken\": %llu, \"notTaken\": %llu}",
+			    pc, program->lines[pc], (unsigned long long)program->taken[pc], (unsigned long long)program->notTaken[pc]);
+			separator = ",\n";
+		}
+	}
+	fprintf(file, "\n  ]\n}\n");
+
+	return fclose(file) == 0;
+}
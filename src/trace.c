@@ -0,0 +1,93 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// mnemonic for every opcode, indexed by the Opcode enum
+static const char *opcodeNames[] = {
+	"MOV", "LD", "ST", "PUSH", "POP", "ADD", "SUB", "MUL", "DIV", "INC", "DEC", "CLR",
+	"AND", "OR", "XOR", "NOT", "JMP", "JEZ", "JLZ", "JGZ", "PRN", "HLT", "NOP",
+	"VADD", "VSUB", "VMUL", "VAND", "VXOR", "VSUM", "CALL", "RET", "RDS",
+	"XCHG", "CAS", "FADD", "BAR", "PRS", "PRZ",
+	"MOD", "SHL", "SHR", "SAR", "ROL", "CMP", "JEQ", "JNE", "JLT", "JGE", "JLTU", "JGEU", "BRK", "LOOP"
+};
+
+const char *traceOpcodeName(unsigned opcode){
+	if(opcode >= sizeof(opcodeNames) / sizeof(opcodeNames[0])){
+		return "???";
+	}
+
+	return opcodeNames[opcode];
+}
+
+// makes a ring buffer able to hold at least the requested amount of records
+Trace *traceCreate(size_t records, const char *sourcePath){
+	// round the capacity up to a power of 2 so the ring index is just a mask
+	size_t capacity = 1;
+	while(capacity < records){
+		capacity *= 2;
+	}
+
+	// using malloc since this can be very large and lives exactly as long as the VM
+	Trace *trace = malloc(sizeof(Trace));
+	TraceRecord *buffer = malloc(sizeof(TraceRecord) * capacity);
+	if(trace == NULL || buffer == NULL){
+		fprintf(stderr, "Not enough memory for a trace of %zu records.\n", capacity);
+		exit(74);
+	}
+
+	trace->records = buffer;
+	trace->mask = capacity - 1;
+	trace->total = 0;
+	trace->sourcePath = sourcePath;
+
+	return trace;
+}
+
+void traceFree(Trace *trace){
+	if(trace == NULL){
+		return;
+	}
+
+	free(trace->records);
+	free(trace);
+}
+
+// writes whatever the ring still holds oldest first, returns 0 on failure
+int traceDump(const Trace *trace, const uint32_t *lines, size_t codeLen, const char *path){
+	FILE *file = fopen(path, "wb");
+	if(file == NULL){
+		return 0;	// false
+	}
+
+	// only the newest capacity records are still around
+	size_t capacity = trace->mask + 1;
+	size_t count = trace->total < capacity ? (size_t)trace->total : capacity;
+	size_t first = (size_t)((trace->total - count) & trace->mask);
+	const char *sourcePath = trace->sourcePath != NULL ? trace->sourcePath : "";
+
+	TraceHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, 4);
+	header.version = TRACE_VERSION;
+	header.total = trace->total;
+	header.recordCount = (uint32_t)count;
+	header.codeLen = (uint32_t)codeLen;
+	header.pathLen = (uint32_t)strlen(sourcePath);
+
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+	    fwrite(sourcePath, 1, header.pathLen, file) == header.pathLen &&
+	    fwrite(lines, sizeof(uint32_t), codeLen, file) == codeLen;
+
+	// the ring may wrap so write it in up to two pieces
+	size_t firstPart = count < capacity - first ? count : capacity - first;
+	ok = ok && fwrite(trace->records + first, sizeof(TraceRecord), firstPart, file) == firstPart;
+	ok = ok && fwrite(trace->records, sizeof(TraceRecord), count - firstPart, file) == count - firstPart;
+
+	if(fclose(file) != 0){
+		ok = 0;
+	}
+
+	return ok;
+}
@@ -0,0 +1,321 @@
+#include "vector.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VECTOR_X86 1
+#include <immintrin.h>
+#endif
+
+// kernel levels picked once at first use based on what the host cpu supports
+typedef enum VectorLevel{
+	LEVEL_UNKNOWN = 0,
+	LEVEL_SCALAR,
+	LEVEL_SSE2,
+	LEVEL_AVX2
+} VectorLevel;
+
+static VectorLevel vectorLevel = LEVEL_UNKNOWN;
+static pthread_once_t vectorLevelOnce = PTHREAD_ONCE_INIT;
+
+// works out which kernels can be used on this machine, only ever run once
+static void pickLevel(void){
+#ifdef VECTOR_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")){
+		vectorLevel = LEVEL_AVX2;
+	}
+	else if(__builtin_cpu_supports("sse2")){
+		vectorLevel = LEVEL_SSE2;
+	}
+	else{
+		vectorLevel = LEVEL_SCALAR;
+	}
+#else
+	vectorLevel = LEVEL_SCALAR;
+#endif
+
+	// LEXI_VECTOR=scalar or sse2 holds the kernels back so tests can check every level on one machine, it never goes above what the cpu has
+	const char *limit = getenv("LEXI_VECTOR");
+	if(limit != NULL){
+		if(strcmp(limit, "scalar") == 0){
+			vectorLevel = LEVEL_SCALAR;
+		}
+		else if(strcmp(limit, "sse2") == 0 && vectorLevel > LEVEL_SSE2){
+			vectorLevel = LEVEL_SSE2;
+		}
+	}
+}
+
+// SPMD cores can all get here first at the same time, pthread_once makes the rest wait for the one picking
+static VectorLevel detectLevel(void){
+	pthread_once(&vectorLevelOnce, pickLevel);
+
+	return vectorLevel;
+}
+
+// plain loop, also used for the tail that doesn't fill a whole lane group
+// the casts back to uint16_t give the same wraparound as execArithmetic truncating its int32 result
+static void applyScalar(Opcode opcode, uint16_t *dest, const uint16_t *src, size_t len){
+	switch(opcode){
+		case OP_VADD:
+			for(size_t i = 0; i < len; i++) dest[i] = (uint16_t)(dest[i] + src[i]);
+			break;
+		case OP_VSUB:
+			for(size_t i = 0; i < len; i++) dest[i] = (uint16_t)(dest[i] - src[i]);
+			break;
+		case OP_VMUL:
+			for(size_t i = 0; i < len; i++) dest[i] = (uint16_t)((uint32_t)dest[i] * (uint32_t)src[i]);
+			break;
+		case OP_VAND:
+			for(size_t i = 0; i < len; i++) dest[i] = (uint16_t)(dest[i] & src[i]);
+			break;
+		case OP_VXOR:
+			for(size_t i = 0; i < len; i++) dest[i] = (uint16_t)(dest[i] ^ src[i]);
+			break;
+		default:
+			break;
+	}
+}
+
+static uint16_t sumScalar(const uint16_t *src, size_t len){
+	uint16_t sum = 0;
+	for(size_t i = 0; i < len; i++){
+		sum = (uint16_t)(sum + src[i]);
+	}
+
+	return sum;
+}
+
+static void narrowScalar(uint8_t *dest, const uint16_t *src, size_t len){
+	for(size_t i = 0; i < len; i++){
+		dest[i] = (uint8_t)src[i];
+	}
+}
+
+static size_t findZeroScalar(const uint16_t *src, size_t len){
+	size_t i = 0;
+	while(i < len && src[i] != 0){
+		i++;
+	}
+
+	return i;
+}
+
+#ifdef VECTOR_X86
+// 8 lanes of 16 bits, returns how many words were handled so the caller can finish the tail
+#define SSE2_LOOP(intrinsic) \
+	for(; i + 8 <= len; i += 8){ \
+		__m128i a = _mm_loadu_si128((const __m128i *)(dest + i)); \
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i)); \
+		_mm_storeu_si128((__m128i *)(dest + i), intrinsic(a, b)); \
+	}
+
+__attribute__((target("sse2")))
+static size_t applySSE2(Opcode opcode, uint16_t *dest, const uint16_t *src, size_t len){
+	size_t i = 0;
+	switch(opcode){
+		case OP_VADD: SSE2_LOOP(_mm_add_epi16); break;
+		case OP_VSUB: SSE2_LOOP(_mm_sub_epi16); break;
+		case OP_VMUL: SSE2_LOOP(_mm_mullo_epi16); break;
+		case OP_VAND: SSE2_LOOP(_mm_and_si128); break;
+		case OP_VXOR: SSE2_LOOP(_mm_xor_si128); break;
+		default: break;
+	}
+
+	return i;
+}
+
+__attribute__((target("sse2")))
+static uint16_t sumSSE2(const uint16_t *src, size_t len, size_t *handled){
+	__m128i acc = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i + 8 <= len; i += 8){
+		acc = _mm_add_epi16(acc, _mm_loadu_si128((const __m128i *)(src + i)));
+	}
+
+	// fold the lanes down, addition mod 2^16 doesn't care about order
+	uint16_t lanes[8];
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	*handled = i;
+
+	return sumScalar(lanes, 8);
+}
+
+// masking off the high bytes first keeps the saturating pack from clamping anything
+__attribute__((target("sse2")))
+static size_t narrowSSE2(uint8_t *dest, const uint16_t *src, size_t len){
+	const __m128i low = _mm_set1_epi16(0x00FF);
+	size_t i = 0;
+	for(; i + 16 <= len; i += 16){
+		__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + i)), low);
+		__m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + i + 8)), low);
+		_mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(a, b));
+	}
+
+	return i;
+}
+
+// compares 8 words at a time, each word that matched sets 2 bits of the mask
+__attribute__((target("sse2")))
+static size_t findZeroSSE2(const uint16_t *src, size_t len){
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i + 8 <= len; i += 8){
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(src + i)), zero));
+		if(mask != 0){
+			return i + (size_t)__builtin_ctz((unsigned)mask) / 2;
+		}
+	}
+
+	return i + findZeroScalar(src + i, len - i);
+}
+
+// same thing with 16 lanes
+#define AVX2_LOOP(intrinsic) \
+	for(; i + 16 <= len; i += 16){ \
+		__m256i a = _mm256_loadu_si256((const __m256i *)(dest + i)); \
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + i)); \
+		_mm256_storeu_si256((__m256i *)(dest + i), intrinsic(a, b)); \
+	}
+
+__attribute__((target("avx2")))
+static size_t applyAVX2(Opcode opcode, uint16_t *dest, const uint16_t *src, size_t len){
+	size_t i = 0;
+	switch(opcode){
+		case OP_VADD: AVX2_LOOP(_mm256_add_epi16); break;
+		case OP_VSUB: AVX2_LOOP(_mm256_sub_epi16); break;
+		case OP_VMUL: AVX2_LOOP(_mm256_mullo_epi16); break;
+		case OP_VAND: AVX2_LOOP(_mm256_and_si256); break;
+		case OP_VXOR: AVX2_LOOP(_mm256_xor_si256); break;
+		default: break;
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static uint16_t sumAVX2(const uint16_t *src, size_t len, size_t *handled){
+	__m256i acc = _mm256_setzero_si256();
+	size_t i = 0;
+	for(; i + 16 <= len; i += 16){
+		acc = _mm256_add_epi16(acc, _mm256_loadu_si256((const __m256i *)(src + i)));
+	}
+
+	uint16_t lanes[16];
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	*handled = i;
+
+	return sumScalar(lanes, 16);
+}
+
+// the pack works inside each 128 bit half, the permute puts the halves back in order
+__attribute__((target("avx2")))
+static size_t narrowAVX2(uint8_t *dest, const uint16_t *src, size_t len){
+	const __m256i low = _mm256_set1_epi16(0x00FF);
+	size_t i = 0;
+	for(; i + 32 <= len; i += 32){
+		__m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(src + i)), low);
+		__m256i b = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(src + i + 16)), low);
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+		_mm256_storeu_si256((__m256i *)(dest + i), packed);
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t findZeroAVX2(const uint16_t *src, size_t len){
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+	for(; i + 16 <= len; i += 16){
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(src + i)), zero));
+		if(mask != 0){
+			return i + (size_t)__builtin_ctz(mask) / 2;
+		}
+	}
+
+	return i + findZeroScalar(src + i, len - i);
+}
+#endif
+
+// runs the widest kernel available then finishes the leftovers one word at a time
+void vectorApply(Opcode opcode, BITSIZE *dest, const BITSIZE *src, size_t len){
+	// if dest starts inside src the scalar loop reads words it already wrote, lanes would read them early
+	if(dest > src && dest < src + len){
+		applyScalar(opcode, dest, src, len);
+		return;
+	}
+
+	size_t done = 0;
+#ifdef VECTOR_X86
+	switch(detectLevel()){
+		case LEVEL_AVX2:
+			done = applyAVX2(opcode, dest, src, len);
+			break;
+		case LEVEL_SSE2:
+			done = applySSE2(opcode, dest, src, len);
+			break;
+		default:
+			break;
+	}
+#endif
+	applyScalar(opcode, dest + done, src + done, len - done);
+}
+
+BITSIZE vectorSum(const BITSIZE *src, size_t len){
+	size_t done = 0;
+	uint16_t sum = 0;
+#ifdef VECTOR_X86
+	switch(detectLevel()){
+		case LEVEL_AVX2:
+			sum = sumAVX2(src, len, &done);
+			break;
+		case LEVEL_SSE2:
+			sum = sumSSE2(src, len, &done);
+			break;
+		default:
+			break;
+	}
+#else
+	(void)detectLevel;
+#endif
+
+	return (BITSIZE)(sum + sumScalar(src + done, len - done));
+}
+
+void vectorNarrow(uint8_t *dest, const BITSIZE *src, size_t len){
+	size_t done = 0;
+#ifdef VECTOR_X86
+	switch(detectLevel()){
+		case LEVEL_AVX2:
+			done = narrowAVX2(dest, src, len);
+			break;
+		case LEVEL_SSE2:
+			done = narrowSSE2(dest, src, len);
+			break;
+		default:
+			break;
+	}
+#endif
+	narrowScalar(dest + done, src + done, len - done);
+}
+
+size_t vectorFindZero(const BITSIZE *src, size_t len){
+#ifdef VECTOR_X86
+	switch(detectLevel()){
+		case LEVEL_AVX2:
+			return findZeroAVX2(src, len);
+		case LEVEL_SSE2:
+			return findZeroSSE2(src, len);
+		default:
+			break;
+	}
+#endif
+
+	return findZeroScalar(src, len);
+}
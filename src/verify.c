@@ -0,0 +1,168 @@
+#include "verify.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define OPERAND_NONE 0x1F
+#define OPERAND_IMMEDIATE 0x1E
+#define OPCODE_SHIFT 10
+#define DEST_SHIFT 5
+#define FIELD_MASK 0x1F
+
+static int isRegister(int field){
+	return field >= REG_0 && field <= REG_ACC;
+}
+
+// instructions whose second word is a code address
+static int isDirectJump(Opcode opcode){
+	switch(opcode){
+		case OP_JMP:
+		case OP_JEZ:
+		case OP_JLZ:
+		case OP_JGZ:
+		case OP_CALL:
+		case OP_JEQ:
+		case OP_JNE:
+		case OP_JLT:
+		case OP_JGE:
+		case OP_JLTU:
+		case OP_JGEU:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// mirrors the shapes the compiler emits, anything else is treated as corrupt
+size_t verifyInstructionWords(BITSIZE word){
+	Opcode opcode = (Opcode)((word >> OPCODE_SHIFT) & 0x3F);
+	int destField = (int)((word >> DEST_SHIFT) & FIELD_MASK);
+	int srcField = (int)(word & FIELD_MASK);
+
+	switch(opcode){
+		case OP_MOV:
+		case OP_CMP:	// register or immediate source
+			if(!isRegister(destField)){
+				return 0;
+			}
+			if(srcField == OPERAND_IMMEDIATE){
+				return 2;
+			}
+			return isRegister(srcField) ? 1 : 0;
+		case OP_LD:
+		case OP_ST:	// address in the next word
+			return isRegister(destField) && srcField == OPERAND_IMMEDIATE ? 2 : 0;
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_DIV:
+		case OP_MOD:
+		case OP_AND:
+		case OP_OR:
+		case OP_XOR:
+		case OP_SHL:
+		case OP_SHR:
+		case OP_SAR:
+		case OP_ROL:	// a register, or no register and an immediate
+			if(srcField == OPERAND_IMMEDIATE){
+				return destField == OPERAND_NONE ? 2 : 0;
+			}
+			return isRegister(destField) && srcField == OPERAND_NONE ? 1 : 0;
+		case OP_PUSH:
+		case OP_POP:
+		case OP_PRN:
+		case OP_PRZ:
+			return isRegister(destField) && srcField == OPERAND_NONE ? 1 : 0;
+		case OP_INC:
+		case OP_DEC:
+		case OP_CLR:
+		case OP_NOT:
+		case OP_HLT:
+		case OP_NOP:
+		case OP_RET:
+		case OP_BAR:
+			return destField == OPERAND_NONE && srcField == OPERAND_NONE ? 1 : 0;
+		case OP_VADD:
+		case OP_VSUB:
+		case OP_VMUL:
+		case OP_VAND:
+		case OP_VXOR:	// the length register gets checked by the caller since it is in the next word
+			return isRegister(destField) && isRegister(srcField) ? 2 : 0;
+		case OP_VSUM:
+		case OP_RDS:
+		case OP_PRS:
+		case OP_XCHG:
+		case OP_CAS:
+		case OP_FADD:
+			return isRegister(destField) && isRegister(srcField) ? 1 : 0;
+		default:
+			if(isDirectJump(opcode)){
+				return destField == OPERAND_IMMEDIATE && srcField == OPERAND_NONE ? 2 : 0;
+			}
+			return 0;
+	}
+}
+
+static int fail(VerifyError *error, size_t pc, const char *message){
+	error->pc = pc;
+	error->message = message;
+
+	return 0;	// false
+}
+
+int verifyCode(const BITSIZE *code, size_t codeLen, VerifyError *error){
+	// first pass finds where every instruction starts
+	uint8_t *starts = calloc(codeLen + 1, 1);
+	if(starts == NULL){
+		fprintf(stderr, "Not enough memory to verify the program.\n");
+		exit(74);
+	}
+
+	size_t pc = 0;
+	while(pc < codeLen){
+		size_t words = verifyInstructionWords(code[pc]);
+		if(words == 0){
+			free(starts);
+			return fail(error, pc, "Unknown opcode or bad operands");
+		}
+		if(pc + words > codeLen){
+			free(starts);
+			return fail(error, pc, "Instruction runs past the end of the code");
+		}
+
+		starts[pc] = 1;
+		pc += words;
+	}
+	starts[codeLen] = 1;	// a label after the last instruction is fine as long as the jump is never taken
+
+	// second pass checks the words that depend on where everything else is
+	for(pc = 0; pc < codeLen; pc += verifyInstructionWords(code[pc])){
+		Opcode opcode = (Opcode)((code[pc] >> OPCODE_SHIFT) & 0x3F);
+		if(isDirectJump(opcode) && (code[pc + 1] > codeLen || !starts[code[pc + 1]])){
+			free(starts);
+			return fail(error, pc, "Jump target is not the start of an instruction");
+		}
+		if(opcode >= OP_VADD && opcode <= OP_VXOR && !isRegister(code[pc + 1])){
+			free(starts);
+			return fail(error, pc, "Invalid length register");
+		}
+	}
+
+	free(starts);
+
+	return 1;	// true
+}
+
+int verifyTarget(const BITSIZE *code, size_t codeLen, size_t pc){
+	if(pc > codeLen){
+		return 0;	// false
+	}
+
+	size_t at = 0;
+	while(at < pc){
+		at += verifyInstructionWords(code[at]);	// never 0 once verified
+	}
+
+	return at == pc;
+}
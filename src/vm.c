@@ -1,20 +1,46 @@
 #include "vm.h"
-#include "compiler.h"
-
+#include "idiom.h"
+#include "mapping.h"
+#include "perf.h"
+#include "prerun.h"
+#include "profile.h"
+#include "program.h"
+#include "spmd.h"
+#include "stats.h"
+#include "trace.h"
+#include "vector.h"
+
+#include <errno.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #define OPERAND_NONE 0x1F
 #define OPERAND_IMMEDIATE 0x1E
 #define OPCODE_SHIFT 10
 #define DEST_SHIFT 5
 #define FIELD_MASK 0x1F
-#define IO_PORT 0xFF00
 
-// reports errors to the console and exits, takes in dynamic amount of args which shows args
+// the VM currently running on this thread, lets vmError find the trace to dump and where to jump back to
+static _Thread_local VM *activeVM = NULL;
+
+// writes out the trace if there is one
+static void dumpTrace(VM *vm){
+	if(vm->trace == NULL){
+		return;
+	}
+
+	if(!traceDump(vm->trace, vm->lines, vm->codeLen, vm->tracePath)){
+		fprintf(stderr, "Could not write trace \"%s\".\n", vm->tracePath);
+	}
+}
+
+// reports errors to the console and stops the VM, takes in dynamic amount of args which shows args
 static void vmError(const char *fmt, ...){
 	// init the dynamic args list
 	va_list args;
@@ -24,20 +50,27 @@ static void vmError(const char *fmt, ...){
 	fprintf(stderr, "[VM]: ");
 	vfprintf(stderr, fmt, args);
 	fputs("\n", stderr);
+	va_end(args);	// done with the dynamic array
+
+	// back out to vmExecute, the trace is most useful right here so save it first
+	if(activeVM != NULL){
+		dumpTrace(activeVM);
+		traceFree(activeVM->trace);	// already written so stop recording into it
+		activeVM->trace = NULL;
+		longjmp(*activeVM->errorJump, 1);
+	}
 
-	// end the dynamic array and exit
-	va_end(args);
-	exit(68);
+	exit(68);	// only reached when no VM is running yet (like failing to map memory)
 }
 
 // fetches a vm word (16 bit value) from the bytecode based on the PC
 static inline uint16_t fetchWord(VM *vm){
-	if((size_t)vm->registers[REG_PC] >= vm->bytecode->codeLen){
+	if((size_t)vm->registers[REG_PC] >= vm->codeLen){
 		vmError("Unexpected end of bytecode");	// if trying to fetch another word but hit end
 	}
 
 	// get the value from bytecode and increment the PC
-	uint16_t value = vm->bytecode->code[vm->registers[REG_PC]];
+	uint16_t value = vm->code[vm->registers[REG_PC]];
 	vm->registers[REG_PC] = (BITSIZE)((size_t)vm->registers[REG_PC] + 1);
 
 	return value;
@@ -68,6 +101,13 @@ static inline uint16_t toUnsigned(int32_t value){
 	return (uint16_t)(value & 0xFFFF);
 }
 
+// stops writes into a read only file window, they would fault the host
+static inline void requireWritable(VM *vm, BITSIZE base, size_t len){
+	if(vm->readOnlyWords > 0 && (size_t)base < (size_t)vm->readOnlyBase + vm->readOnlyWords && (size_t)base + len > vm->readOnlyBase){
+		vmError("Write to read only memory at 0x%04X", base);
+	}
+}
+
 // MOV opcode used to move between registers
 static void execMove(VM *vm, int destField, int srcField){
 	BITSIZE *dest = requireRegister(vm, destField);	// get the address of the destination registers value
@@ -91,7 +131,11 @@ static void execLoad(VM *vm, int destField, int srcField){
 	BITSIZE *dest = requireRegister(vm, destField);
 	uint16_t addr = fetchImmediate(vm);
 
-	// set the value of the register as the value in memory
+	// set the value of the register as the value in memory, the top page goes to the devices instead
+	if(addr >= DEVICE_BASE){
+		*dest = deviceRead(vm, addr);
+		return;
+	}
 	*dest = vm->memory[addr];
 }
 
@@ -105,20 +149,19 @@ static void execStore(VM *vm, int regField, int srcField){
 	BITSIZE *reg = requireRegister(vm, regField);
 	uint16_t addr = fetchImmediate(vm);
 
+	// if we put a value in the device page let whatever is attached to that port handle it
+	if(addr >= DEVICE_BASE){
+		deviceWrite(vm, addr, *reg);
+		return;
+	}
+
 	// store the value in the address
+	requireWritable(vm, addr, 1);
 	vm->memory[addr] = *reg;
-
-	// if we put a value at a designated IO port (only one rn is 0xFF00 for printing)
-	if(addr == IO_PORT){
-		putchar((int)(*reg & 0xFF));	// print the value at that address
-		fflush(stdout);
-	}
 }
 
-// PUSH opcode used to push a value onto the stack
-static void execPush(VM *vm, int regField){
-	BITSIZE *reg = requireRegister(vm, regField);	// get the source register address
-	
+// pushes a value onto the stack, shared by PUSH and CALL
+static inline void pushValue(VM *vm, BITSIZE value){
 	// STACK OVERFLOW REFERENCE :O
 	if(vm->stackCount >= MAXSIZE){
 		vmError("Stack overflow");
@@ -126,34 +169,48 @@ static void execPush(VM *vm, int regField){
 
 	// set the value in the stack at the SP register
 	vm->registers[REG_SP] = (BITSIZE)((size_t)vm->registers[REG_SP] - 1);
-	vm->memory[vm->registers[REG_SP]] = *reg;	// stack is stored at the top of vm memory
+	requireWritable(vm, vm->registers[REG_SP], 1);
+	vm->memory[vm->registers[REG_SP]] = value;	// stack is stored at the top of vm memory
 
 	// increment stack count
 	vm->stackCount++;
 }
 
-// POP opcode used to get values from the stack
-static void execPop(VM *vm, int regField){
+// pops a value from the stack, shared by POP and RET
+static inline BITSIZE popValue(VM *vm){
 	if(vm->stackCount == 0){	// if stack is empty
 		vmError("Stack underflow");
 	}
 
 	// get the value from the stack
 	BITSIZE value = vm->memory[vm->registers[REG_SP]];
-	BITSIZE *dest = requireRegister(vm, regField);	// get the address of the register the value is going to 
-
-	*dest = value;	// put the value in the register
 
 	// move the stackpointer and decrement stackCount
 	vm->registers[REG_SP] = (BITSIZE)((size_t)vm->registers[REG_SP] + 1);
 	vm->stackCount--;
+
+	return value;
 }
 
-// This is an accumulation of opcodes: ADD SUB MUL DIV AND OR XOR
-static void execArithmetic(VM *vm, Opcode opcode, int regField){
-	BITSIZE *operand = requireRegister(vm, regField);	// get the address of register
+// PUSH opcode used to push a value onto the stack
+static void execPush(VM *vm, int regField){
+	BITSIZE *reg = requireRegister(vm, regField);	// get the source register address
+	pushValue(vm, *reg);
+}
+
+// POP opcode used to get values from the stack
+static void execPop(VM *vm, int regField){
+	BITSIZE *dest = requireRegister(vm, regField);	// get the address of the register the value is going to 
+	*dest = popValue(vm);	// put the value in the register
+}
+
+// This is an accumulation of opcodes: ADD SUB MUL DIV MOD AND OR XOR SHL SHR SAR ROL
+// the operand is either a register or, when the src field says so, the word after the instruction
+static void execArithmetic(VM *vm, Opcode opcode, int regField, int srcField){
+	BITSIZE operand = srcField == OPERAND_IMMEDIATE ? fetchImmediate(vm) : *requireRegister(vm, regField);
 	int32_t acc = toSigned(vm->registers[REG_ACC]);	// get the value in ACC
-	int32_t value = toSigned(*operand);	// convert the value from the register to signed
+	int32_t value = toSigned(operand);	// convert the operand to signed
+	uint16_t bits = (uint16_t)vm->registers[REG_ACC];	// shifts work on the raw bits
 
 	// Opcode switch
 	switch(opcode){
@@ -167,27 +224,66 @@ static void execArithmetic(VM *vm, Opcode opcode, int regField){
 			acc *= value;
 			break;
 		case OP_DIV:
-			if(*operand == 0){	// prevent division by 0
+			if(operand == 0){	// prevent division by 0
 				vmError("Division by zero");
 			}
 			acc /= value;
 			break;
+		case OP_MOD:
+			if(operand == 0){
+				vmError("Division by zero");
+			}
+			acc %= value;
+			break;
 		case OP_AND:
-			acc = (int32_t)((uint16_t)vm->registers[REG_ACC] & (uint16_t)*operand);
+			acc = (int32_t)((uint16_t)vm->registers[REG_ACC] & (uint16_t)operand);
 			break;
 		case OP_OR:
-			acc = (int32_t)((uint16_t)vm->registers[REG_ACC] | (uint16_t)*operand);
+			acc = (int32_t)((uint16_t)vm->registers[REG_ACC] | (uint16_t)operand);
 			break;
 		case OP_XOR:
-			acc = (int32_t)((uint16_t)vm->registers[REG_ACC] ^ (uint16_t)*operand);
+			acc = (int32_t)((uint16_t)vm->registers[REG_ACC] ^ (uint16_t)operand);
+			break;
+		// shifting by 16 or more moves every bit out, rotating only cares about the amount mod 16
+		case OP_SHL:
+			acc = operand >= 16 ? 0 : (int32_t)(uint16_t)(bits << operand);
+			break;
+		case OP_SHR:
+			acc = operand >= 16 ? 0 : (int32_t)(bits >> operand);
 			break;
+		case OP_SAR:
+			acc = toSigned(bits) >> (operand >= 16 ? 15 : operand);
+			break;
+		case OP_ROL:{
+			unsigned amount = operand & 15;
+			acc = (int32_t)(uint16_t)((bits << amount) | (bits >> ((16 - amount) & 15)));
+			break;
+		}
 		default:
 			vmError("Unsupported arithmetic opcode");	// if the opcode is something that it shouldn't be
 	}
 	vm->registers[REG_ACC] = toUnsigned(acc);	// move the value result back into ACC
 }
 
-// Collection of all jump opcodes: JMP JLZ JEZ JGZ
+// CMP opcode compares a register against a register or immediate, only the flags change
+static void execCompare(VM *vm, int regField, int srcField){
+	BITSIZE left = *requireRegister(vm, regField);
+	BITSIZE right = srcField == OPERAND_IMMEDIATE ? fetchImmediate(vm) : *requireRegister(vm, srcField);
+
+	uint8_t flags = 0;
+	if(left == right){
+		flags |= FLAG_EQUAL;
+	}
+	if(toSigned(left) < toSigned(right)){
+		flags |= FLAG_LESS;
+	}
+	if(left < right){
+		flags |= FLAG_BELOW;
+	}
+	vm->flags = flags;
+}
+
+// Collection of all jump opcodes: JMP JLZ JEZ JGZ and the flag jumps JEQ JNE JLT JGE JLTU JGEU
 static void execJump(VM *vm, Opcode opcode, int destField){
 	if(destField != OPERAND_IMMEDIATE){	// jump has to have a destination
 		vmError("Jump missing immediate target");
@@ -209,103 +305,632 @@ static void execJump(VM *vm, Opcode opcode, int destField){
 		case OP_JGZ:
 			shouldJump = (acc > 0);
 			break;
+		case OP_JEQ:
+			shouldJump = (vm->flags & FLAG_EQUAL) != 0;
+			break;
+		case OP_JNE:
+			shouldJump = (vm->flags & FLAG_EQUAL) == 0;
+			break;
+		case OP_JLT:
+			shouldJump = (vm->flags & FLAG_LESS) != 0;
+			break;
+		case OP_JGE:
+			shouldJump = (vm->flags & FLAG_LESS) == 0;
+			break;
+		case OP_JLTU:
+			shouldJump = (vm->flags & FLAG_BELOW) != 0;
+			break;
+		case OP_JGEU:
+			shouldJump = (vm->flags & FLAG_BELOW) == 0;
+			break;
 		default:
 			vmError("Invalid jump opcode");	// if the opcode matches nothing
 	}
 
 	// if we should jump then move the PC to the target
 	if(shouldJump){
-		if(target >= vm->bytecode->codeLen){	// make sure in range
+		if(target >= vm->codeLen){	// make sure in range
 			vmError("Jump target out of range: %u", target);
 		}
 		vm->registers[REG_PC] = target;
 	}
 }
 
-// main run function that starts VM execution
-int vmRun(Bytecode *bytecode){
-	if(bytecode == NULL){	// must have bytecode
-		return -1;
+// CALL opcode pushes the address after itself and jumps to the label
+static void execCall(VM *vm, int destField){
+	if(destField != OPERAND_IMMEDIATE){	// call has to have a destination
+		vmError("Call missing immediate target");
 	}
 
-	// make the VM object and set all of the values
-	VM vm;
-	memset(&vm, 0, sizeof(VM));
-	vm.bytecode = bytecode;
-	vm.running = 1;
-	vm.registers[REG_PC] = 0;
-	vm.registers[REG_SP] = 0;
-	vm.registers[REG_ACC] = 0;
-	memset(vm.memory, 0, sizeof(vm.memory));
+	uint16_t target = fetchImmediate(vm);	// PC now points at the return address
+	if(target >= vm->codeLen){	// make sure in range
+		vmError("Call target out of range: %u", target);
+	}
+
+	BITSIZE returnAddress = vm->registers[REG_PC];
+	pushValue(vm, returnAddress);
+
+	// remember it in the shadow stack too, once it is full older entries just aren't tracked
+	if(vm->returnDepth < RETURN_STACK_SIZE){
+		vm->returnStack[vm->returnDepth] = returnAddress;
+	}
+	vm->returnDepth++;
+
+	vm->registers[REG_PC] = target;
+}
+
+// RET opcode pops the return address and jumps back to it
+static void execReturn(VM *vm){
+	BITSIZE target = popValue(vm);
+	if(target >= vm->codeLen){	// the program may have changed the stack under us
+		vmError("Return address out of range: %u", target);
+	}
+
+	// keep the shadow stack in sync, if the program rewrote its return address the shadow stack is no longer trustworthy
+	if(vm->returnDepth > 0){
+		vm->returnDepth--;
+		if(vm->returnDepth < RETURN_STACK_SIZE && vm->returnStack[vm->returnDepth] != target){
+			vm->returnDepth = 0;
+		}
+	}
+
+	vm->registers[REG_PC] = target;
+}
+
+// makes sure a range of memory stays inside general purpose RAM (never touches the device page)
+static inline BITSIZE *requireRange(VM *vm, BITSIZE base, BITSIZE len){
+	if((size_t)base + (size_t)len > DEVICE_BASE){
+		vmError("Vector range 0x%04X + %u out of bounds", base, len);
+	}
+
+	return &vm->memory[base];
+}
+
+// Collection of all vector opcodes: VADD VSUB VMUL VAND VXOR VSUM
+static void execVector(VM *vm, Opcode opcode, int destField, int srcField){
+	if(opcode == OP_VSUM){	// VSUM packs both registers into the first word
+		BITSIZE base = *requireRegister(vm, destField);
+		BITSIZE len = *requireRegister(vm, srcField);
+		vm->registers[REG_ACC] = vectorSum(requireRange(vm, base, len), len);
+		return;
+	}
+
+	// the length register is stored in the word after the instruction
+	BITSIZE len = *requireRegister(vm, (int)fetchImmediate(vm));
+	BITSIZE destBase = *requireRegister(vm, destField);
+	BITSIZE *dest = requireRange(vm, destBase, len);
+	BITSIZE *src = requireRange(vm, *requireRegister(vm, srcField), len);
+	requireWritable(vm, destBase, len);
+
+	vectorApply(opcode, dest, src, len);
+}
 
+// RDS opcode pulls a block of input into memory in one go
+static void execReadString(VM *vm, int addrField, int lenField){
+	BITSIZE base = *requireRegister(vm, addrField);
+	BITSIZE len = *requireRegister(vm, lenField);
+	BITSIZE *dest = requireRange(vm, base, len);
+	requireWritable(vm, base, len);
+
+	deviceBeforeWait(vm);	// the read can block
+	vm->registers[REG_ACC] = (BITSIZE)inputReadBulk(&vm->input, dest, len);
+}
+
+// PRS opcode prints a block of memory in one go
+static void execPrintString(VM *vm, int addrField, int lenField){
+	BITSIZE base = *requireRegister(vm, addrField);
+	BITSIZE len = *requireRegister(vm, lenField);
+
+	consoleWriteBulk(vm, requireRange(vm, base, len), len);
+}
+
+// PRZ opcode prints up to the 0 that ends a string, the 0 itself isn't printed
+static void execPrintTerminated(VM *vm, int addrField){
+	BITSIZE base = *requireRegister(vm, addrField);
+	if(base >= DEVICE_BASE){
+		vmError("String at 0x%04X starts in the device page", base);
+	}
+
+	const BITSIZE *src = &vm->memory[base];
+	size_t len = vectorFindZero(src, DEVICE_BASE - base);
+	if(len == (size_t)(DEVICE_BASE - base)){
+		vmError("String at 0x%04X has no terminator before the device page", base);
+	}
+
+	consoleWriteBulk(vm, src, len);
+	vm->registers[REG_ACC] = (BITSIZE)len;
+}
+
+// Collection of all atomic opcodes: XCHG CAS FADD
+// they are atomic on any RAM address, but only the shared window is seen by other cores
+static void execAtomic(VM *vm, Opcode opcode, int regField, int addrField){
+	BITSIZE *reg = requireRegister(vm, regField);
+	BITSIZE addr = *requireRegister(vm, addrField);
+	if(addr >= DEVICE_BASE){	// ports aren't memory so there is nothing to be atomic about
+		vmError("Atomic access to device port 0x%04X", addr);
+	}
+	requireWritable(vm, addr, 1);
+
+	BITSIZE *cell = &vm->memory[addr];
+	switch(opcode){
+		case OP_XCHG:
+			*reg = __atomic_exchange_n(cell, *reg, __ATOMIC_SEQ_CST);
+			break;
+		case OP_CAS:{
+			BITSIZE expected = vm->registers[REG_ACC];
+			int swapped = __atomic_compare_exchange_n(cell, &expected, *reg, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+			*reg = expected;	// whatever was there, equal to ACC if the swap happened
+			vm->registers[REG_ACC] = (BITSIZE)swapped;
+			break;
+		}
+		case OP_FADD:
+			*reg = __atomic_fetch_add(cell, *reg, __ATOMIC_SEQ_CST);
+			break;
+		default:
+			vmError("Invalid atomic opcode");
+	}
+}
+
+// maps a zeroed address space, the kernel only backs pages once they are written so nothing has to be cleared up front
+static BITSIZE *memoryCreate(void){
+	void *memory = mmap(NULL, sizeof(BITSIZE) * MAXSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(memory == MAP_FAILED){
+		vmError("Could not map VM memory");
+	}
+
+	return memory;
+}
+
+static void memoryFree(BITSIZE *memory){
+	munmap(memory, sizeof(BITSIZE) * MAXSIZE);
+}
+
+// maps words of fd over part of this VM's memory (shared between VMs or file backed), the window has to line up with host pages
+// returns 0 if it doesn't or it runs into the device page
+int vmMapWindow(VM *vm, BITSIZE base, size_t words, int fd, off_t offset, int prot, int flags){
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = (size_t)base * sizeof(BITSIZE);
+	size_t length = words * sizeof(BITSIZE);
+	if(words == 0 || start % page != 0 || length % page != 0 || (size_t)base + words > DEVICE_BASE){
+		errno = EINVAL;
+		return 0;
+	}
+
+	// MAP_FIXED swaps the private pages out in place, memoryFree still unmaps the whole range
+	void *window = mmap(vm->memory + base, length, prot, flags | MAP_FIXED, fd, offset);
+
+	return window != MAP_FAILED;
+}
+
+// copies initialized data into memory, windows are always mapped first so data in the shared window sets it up
+// returns 0 without copying anything if it would land in the mapped file's window, it would hide the file (or can't be written at all)
+int vmLoadData(VM *vm, size_t address, const BITSIZE *words, size_t count){
+	if(count == 0){
+		return 1;	// true
+	}
+	if(vm->mapping != NULL && address < (size_t)vm->mapping->base + vm->mapping->words && vm->mapping->base < address + count){
+		return 0;	// false
+	}
+
+	memcpy(vm->memory + address, words, sizeof(BITSIZE) * count);
+
+	return 1;
+}
+
+// copies every run of a program's data in, returns the first run that would land in the mapped file's window or NULL
+const DataRun *vmLoadProgramData(VM *vm, const Program *program){
+	const BITSIZE *words = program->data;
+	for(size_t i = 0; i < program->runCount; i++){
+		if(!vmLoadData(vm, program->runs[i].base, words, program->runs[i].len)){
+			return &program->runs[i];
+		}
+		words += program->runs[i].len;
+	}
+
+	return NULL;
+}
+
+// works out which memory address an instruction that just ran touched, only used while tracing
+static inline int tracedAddress(VM *vm, Opcode opcode, BITSIZE pc, int destField, int srcField, uint16_t *addr){
+	switch(opcode){
+		case OP_LD:
+		case OP_ST:	// the address is the word after the instruction
+			*addr = vm->code[pc + 1];
+			return 1;
+		case OP_PUSH:
+		case OP_CALL:	// SP points at what was just written
+			*addr = vm->registers[REG_SP];
+			return 1;
+		case OP_POP:
+		case OP_RET:	// SP has moved just past what was read
+			*addr = (uint16_t)(vm->registers[REG_SP] - 1);
+			return 1;
+		case OP_PRN:
+			*addr = PORT_CONSOLE;
+			return 1;
+		case OP_VADD:
+		case OP_VSUB:
+		case OP_VMUL:
+		case OP_VAND:
+		case OP_VXOR:
+		case OP_VSUM:
+		case OP_RDS:
+		case OP_PRS:
+		case OP_PRZ:	// start of the range
+			*addr = vm->registers[destField];
+			return 1;
+		case OP_XCHG:
+		case OP_CAS:
+		case OP_FADD:	// the address register, unless the instruction overwrote it
+			*addr = vm->registers[srcField];
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+// counts the instruction that just ran, only called while stats are on
+static inline void recordStats(VM *vm, Opcode opcode, BITSIZE pc){
+	Stats *stats = vm->stats;
+	stats->instructions++;
+	stats->opcodes[opcode]++;
+	if(stats->previous != STATS_NO_PREVIOUS){
+		stats->bigrams[stats->previous][opcode]++;
+	}
+	stats->previous = opcode;
+
+	if(vm->stackCount > stats->stackHighWater){
+		stats->stackHighWater = vm->stackCount;
+	}
+
+	// a conditional jump went somewhere other than the next instruction if it was taken
+	// code attached after the VM was made (the REPL) has no jump table
+	JumpStats *jumps = &stats->programs[0];
+	if(((opcode >= OP_JEZ && opcode <= OP_JGZ) || (opcode >= OP_JEQ && opcode <= OP_JGEU)) && pc < jumps->codeLen){
+		if(vm->registers[REG_PC] != (BITSIZE)(pc + 2)){
+			jumps->taken[pc]++;
+		}
+		else{
+			jumps->notTaken[pc]++;
+		}
+	}
+}
+
+// runs a whole countdown loop at once, the count this instruction already added stands for the first DEC
+// returns 0 when something has to see every instruction go by, or the budget would run out part way through
+static int execLoop(VM *vm, BITSIZE pc, Idiom idiom){
+	if(vm->trace != NULL || vm->stats != NULL || vm->prerun != NULL){
+		return 0;	// false
+	}
+
+	BITSIZE acc = vm->registers[REG_ACC];
+	uint64_t instructions;
+	idiomCountdown(idiom, &acc, &instructions);
+	if(vm->instructionLimit - vm->instructionCount < instructions - 1){
+		return 0;
+	}
+
+	vm->instructionCount += instructions - 1;
+	vm->registers[REG_ACC] = acc;
+	vm->registers[REG_PC] = idiom == IDIOM_DEC_JGZ ? (BITSIZE)(pc + 3) : vm->code[pc + 2];
+
+	return 1;	// true
+}
+
+// the dispatch loop, runs until HLT or the PC walks off the end of the code
+static void runLoop(VM *vm){
 	// main execution loop
-	while(vm.running){
-		if((size_t)vm.registers[REG_PC] >= vm.bytecode->codeLen){
+	while(vm->running){
+		if((size_t)vm->registers[REG_PC] >= vm->codeLen){
 			break;	// make sure the PC does not go out of bounds
 		}
 
-		uint16_t word = fetchWord(&vm);	// get the next value from bytecode
+		BITSIZE pc = vm->registers[REG_PC];	// where this instruction starts
+		vm->samplePc = pc;
+		uint16_t word = fetchWord(vm);	// get the next value from bytecode
 		Opcode opcode = (Opcode)((word >> OPCODE_SHIFT) & 0x3F);	// mask off the opcode
 		int destField = (int)((word >> DEST_SHIFT) & FIELD_MASK);	// mask off and store destination
 		int srcField = (int)(word & FIELD_MASK);	// mask off and store source
 
+		// when running ahead of time stop right before anything that has to wait for the real run
+		if(vm->prerun != NULL && !prerunAllows(vm, pc, opcode, destField, srcField)){
+			vm->registers[REG_PC] = pc;
+			vm->running = 0;
+			break;
+		}
+		if(++vm->instructionCount > vm->instructionLimit){
+			if(vm->instructionCount > vm->instructionBudget){
+				vmError("Instruction budget of %llu used up", (unsigned long long)vm->instructionBudget);
+			}
+			vm->instructionCount--;	// a debugger step is over, this one runs next time
+			vm->registers[REG_PC] = pc;
+			vm->running = 0;
+			vm->paused = 1;
+			break;
+		}
+
 		// main switch
 		switch(opcode){
 			case OP_MOV:
-				execMove(&vm, destField, srcField);
+				execMove(vm, destField, srcField);
 				break;
 			case OP_LD:
-				execLoad(&vm, destField, srcField);
+				execLoad(vm, destField, srcField);
 				break;
 			case OP_ST:
-				execStore(&vm, destField, srcField);
+				execStore(vm, destField, srcField);
 				break;
 			case OP_PUSH:
-				execPush(&vm, destField);
+				execPush(vm, destField);
 				break;
 			case OP_POP:
-				execPop(&vm, destField);
+				execPop(vm, destField);
 				break;
 			case OP_ADD:
 			case OP_SUB:
 			case OP_MUL:
 			case OP_DIV:
+			case OP_MOD:
 			case OP_AND:
 			case OP_OR:
 			case OP_XOR:
-				execArithmetic(&vm, opcode, destField);
+			case OP_SHL:
+			case OP_SHR:
+			case OP_SAR:
+			case OP_ROL:
+				execArithmetic(vm, opcode, destField, srcField);
 				break;
 			case OP_INC:
-				vm.registers[REG_ACC] = toUnsigned(toSigned(vm.registers[REG_ACC]) + 1);
+				vm->registers[REG_ACC] = toUnsigned(toSigned(vm->registers[REG_ACC]) + 1);
 				break;
 			case OP_DEC:
-				vm.registers[REG_ACC] = toUnsigned(toSigned(vm.registers[REG_ACC]) - 1);
+				vm->registers[REG_ACC] = toUnsigned(toSigned(vm->registers[REG_ACC]) - 1);
 				break;
 			case OP_CLR:
-				vm.registers[REG_ACC] = 0;
+				vm->registers[REG_ACC] = 0;
 				break;
 			case OP_NOT:
-				vm.registers[REG_ACC] =(BITSIZE)(~vm.registers[REG_ACC]);
+				vm->registers[REG_ACC] =(BITSIZE)(~vm->registers[REG_ACC]);
 				break;
 			case OP_JMP:
 			case OP_JEZ:
 			case OP_JLZ:
 			case OP_JGZ:
-				execJump(&vm, opcode, destField);
+			case OP_JEQ:
+			case OP_JNE:
+			case OP_JLT:
+			case OP_JGE:
+			case OP_JLTU:
+			case OP_JGEU:
+				execJump(vm, opcode, destField);
+				break;
+			case OP_CMP:
+				execCompare(vm, destField, srcField);
 				break;
-			case OP_PRN:
-				putchar((int)(vm.registers[REG_ACC] & 0xFF));
-				fflush(stdout);
+			case OP_PRN:	// shorthand for ST ACC, [0xFF00]
+				deviceWrite(vm, PORT_CONSOLE, vm->registers[REG_ACC]);
 				break;
 			case OP_HLT:
-				vm.running = 0;
+				deviceBeforeWait(vm);	// what this stage sent shouldn't have to wait for its channel to be closed
+				vm->running = 0;
 				break;
 			case OP_NOP:
 				break;
+			case OP_VADD:
+			case OP_VSUB:
+			case OP_VMUL:
+			case OP_VAND:
+			case OP_VXOR:
+			case OP_VSUM:
+				execVector(vm, opcode, destField, srcField);
+				break;
+			case OP_CALL:
+				execCall(vm, destField);
+				break;
+			case OP_RET:
+				execReturn(vm);
+				break;
+			case OP_RDS:
+				execReadString(vm, destField, srcField);
+				break;
+			case OP_PRS:
+				execPrintString(vm, destField, srcField);
+				break;
+			case OP_PRZ:
+				execPrintTerminated(vm, destField);
+				break;
+			case OP_XCHG:
+			case OP_CAS:
+			case OP_FADD:
+				execAtomic(vm, opcode, destField, srcField);
+				break;
+			case OP_BAR:
+				if(vm->barrier != NULL){	// a lone VM has nobody to wait for
+					deviceBeforeWait(vm);
+					barrierWait(vm->barrier);
+				}
+				break;
+			case OP_LOOP:
+				// only where idiomFold put one, a computed jump can land on the same word anywhere else
+				if(vm->program == NULL || vm->code != vm->program->runCode ||
+				    destField == IDIOM_NONE || idiomMatch(vm->program->code, vm->codeLen, pc) != (Idiom)destField){
+					vmError("Unknown opcode %d", opcode);
+				}
+				if(!execLoop(vm, pc, (Idiom)destField)){
+					opcode = OP_DEC;	// it's the DEC it replaced, run the loop the long way
+					vm->registers[REG_ACC] = toUnsigned(toSigned(vm->registers[REG_ACC]) - 1);
+				}
+				break;
+			case OP_BRK:	// the debugger put this here, stop on it without counting it as run
+				if(!vm->debugging || vm->program->code[pc] == word){	// one the program carried itself isn't a breakpoint
+					vmError("Unknown opcode %d", opcode);
+				}
+				vm->instructionCount--;
+				vm->registers[REG_PC] = pc;
+				vm->running = 0;
+				vm->paused = 1;
+				continue;
 			default:	// if the opcode is non existent then exit
 				vmError("Unknown opcode %d", opcode);
 		}
+
+		// record what just happened, the check is the only cost while tracing is off
+		if(vm->trace != NULL){
+			uint16_t addr = 0;
+			uint8_t flags = tracedAddress(vm, opcode, pc, destField, srcField, &addr) ? TRACE_HAS_ADDR : 0;
+			traceAppend(vm->trace, pc, (uint8_t)opcode, flags, vm->registers[REG_ACC], addr);
+		}
+		if(vm->stats != NULL){
+			recordStats(vm, opcode, pc);
+		}
 	}
-	
+}
+
+// makes a VM ready to run a program from the start, the program is shared not copied
+// picks up where a partially evaluated program left off, the output it skipped over gets printed first
+static void loadStart(VM *vm, const ProgramStart *start){
+	memcpy(vm->registers, start->registers, sizeof(vm->registers));
+	vm->flags = (uint8_t)start->flags;
+	vm->stackCount = start->stackCount;
+	memcpy(&vm->memory[DEVICE_BASE], start->page, sizeof(start->page));
+
+	if(start->outputLen > 0){
+		fwrite(start->output, 1, start->outputLen, stdout);
+		fflush(stdout);
+	}
+}
+
+VM *vmCreate(Program *program, const VMOptions *options){
+	// using malloc since the VM is owned by whoever created it, not the gc
+	VM *vm = malloc(sizeof(VM));
+	if(vm == NULL){
+		fprintf(stderr, "Not enough memory for VM.\n");
+		exit(74);
+	}
+
+	// make the VM object and set all of the values
+	memset(vm, 0, sizeof(VM));
+	vm->program = programRetain(program);
+	if(program != NULL){
+		vmAttachCode(vm, program->runCode, program->lines, program->codeLen);
+	}
+	vm->running = 1;
+	vm->registers[REG_PC] = 0;
+	vm->registers[REG_SP] = 0;
+	vm->registers[REG_ACC] = 0;
+	vm->flags = FLAG_EQUAL;	// as if 0 had been compared with 0
+	vm->memory = memoryCreate();
+	vm->coreId = 0;
+	vm->coreCount = 1;
+	vm->instructionBudget = options != NULL && options->instructionLimit > 0 ? options->instructionLimit : UINT64_MAX;
+	vm->instructionLimit = vm->instructionBudget;
+	deviceInit(vm);
+	if(options != NULL && options->mapPath != NULL){
+		vm->mapping = mappingCreate(vm, options->mapPath, options->mapBase, options->mapWords, options->mapReadOnly);
+		if(vm->mapping == NULL){
+			vmError("Could not map \"%s\" at 0x%04X + 0x%zX: %s", options->mapPath, options->mapBase, options->mapWords, strerror(errno));
+		}
+	}
+	const DataRun *clash = program != NULL ? vmLoadProgramData(vm, program) : NULL;
+	if(clash != NULL){
+		vmError("Data at 0x%04X + 0x%X overlaps the file mapped at 0x%04X + 0x%zX", clash->base, clash->len, options->mapBase, options->mapWords);
+	}
+	if(program != NULL && program->start != NULL){
+		loadStart(vm, program->start);
+	}
+
+	if(options != NULL && options->traceRecords > 0){
+		vm->trace = traceCreate(options->traceRecords, options->sourcePath);
+		vm->tracePath = options->tracePath != NULL ? options->tracePath : TRACE_DEFAULT_PATH;
+	}
+	if(options != NULL && options->stats != NULL){
+		vm->stats = statsCreateRun(options->sourcePath, vm->lines, vm->codeLen);
+		vm->statsSink = options->stats;
+	}
+	if(options != NULL && options->profile != NULL){
+		vm->samples = profileSamplesCreate(options->sourcePath);
+		vm->profileSink = options->profile;
+	}
+
+	return vm;
+}
+
+// points the VM at code that isn't part of a program, the REPL uses this to run bytecode that is still growing
+void vmAttachCode(VM *vm, const BITSIZE *code, const uint32_t *lines, size_t codeLen){
+	vm->code = code;
+	vm->lines = lines;
+	vm->codeLen = codeLen;
+}
+
+// runs from wherever the VM stopped last, returns -1 if it hit an error (the VM stays usable for inspection)
+int vmExecute(VM *vm){
+	jmp_buf errorJump;
+	if(setjmp(errorJump) != 0){
+		vm->errorJump = NULL;
+		vm->running = 0;
+		activeVM = NULL;
+
+		return -1;
+	}
+
+	vm->errorJump = &errorJump;
+	activeVM = vm;
+	runLoop(vm);
+	activeVM = NULL;
+	vm->errorJump = NULL;
+
 	return 0;
 }
+
+// the VM running on this thread, NULL between runs, the profiler's signal handler uses it to find what to sample
+VM *vmActive(void){
+	return activeVM;
+}
+
+// dumps the trace if there is one and gives back everything the VM owns
+void vmDestroy(VM *vm){
+	if(vm == NULL){
+		return;
+	}
+
+	dumpTrace(vm);
+	traceFree(vm->trace);
+	if(vm->stats != NULL){
+		statsMerge(vm->statsSink, vm->stats);
+		statsFree(vm->stats);
+	}
+	if(vm->samples != NULL){
+		profileMerge(vm->profileSink, vm->samples, vm->lines, vm->codeLen);
+		profileSamplesFree(vm->samples);
+	}
+	deviceFree(vm);
+	mappingFree(vm->mapping);
+	memoryFree(vm->memory);
+	programRelease(vm->program);
+	free(vm);
+}
+
+// main run function that starts VM execution
+int vmRun(Program *program, const VMOptions *options){
+	if(program == NULL){	// must have a program
+		return -1;
+	}
+
+	VM *vm = vmCreate(program, options);
+
+	// the counters only wrap execution, not setting up the VM
+	PerfCounters perf;
+	int measure = options != NULL && options->perfCounters;
+	if(measure){
+		perfStart(&perf);
+	}
+	int result = vmExecute(vm);
+	if(measure){
+		perfStop(&perf);
+		perfReport(&perf, vm->instructionCount, stderr);
+	}
+
+	vmDestroy(vm);
+	
+	return result;	// -1 if the VM stopped on an error, it has already been reported
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+# runs every test that has a .out file and compares what it prints with it
+# name.args replaces the command line (default name.lexi), name.in is fed to stdin (default nothing)
+# name.env holds VAR=value pairs set for the run, name.code is the exit code it has to give (default 0)
+cd "$(dirname "$0")/.." || exit 1
+
+actual=$(mktemp) || exit 1
+trap 'rm -f "$actual"' EXIT
+
+failed=0
+for expected in tests/*.out; do
+	name=${expected%.out}
+	args="$name.lexi"
+	if [ -f "$name.args" ]; then
+		args=$(cat "$name.args")
+	fi
+	vars=
+	if [ -f "$name.env" ]; then
+		vars=$(cat "$name.env")
+	fi
+	input=/dev/null
+	if [ -f "$name.in" ]; then
+		input="$name.in"
+	fi
+	code=0
+	if [ -f "$name.code" ]; then
+		code=$(cat "$name.code")
+	fi
+
+	# shellcheck disable=SC2086
+	timeout 10 env $vars ./lexi-lang $args < "$input" > "$actual" 2>&1
+	status=$?
+	if [ "$status" -eq "$code" ] && cmp -s "$actual" "$expected"; then
+		echo "pass $name"
+	else
+		echo "FAIL $name (exit $status)"
+		failed=1
+	fi
+done
+
+exit $failed
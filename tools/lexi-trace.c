@@ -0,0 +1,141 @@
+#include "main.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// decodes a trace dumped by `lexi-lang --trace` and shows every record next to the source line it came from
+
+// for reporting errors while decoding
+static void decodeError(const char *path, const char *message){
+	fprintf(stderr, "[Trace][%s]: %s\n", path, message);
+	exit(74);
+}
+
+// reads exactly size bytes or gives up
+static void readExact(FILE *file, void *dest, size_t size, const char *path){
+	if(size > 0 && fread(dest, 1, size, file) != size){
+		decodeError(path, "Trace file is truncated");
+	}
+}
+
+// loads a source file and splits it in place into lines, lines[n] is line n + 1
+static char **readSourceLines(const char *path, size_t *lineCount){
+	*lineCount = 0;
+	FILE *file = fopen(path, "rb");
+	if(file == NULL){
+		return NULL;	// source is optional, records are still printed without it
+	}
+
+	// read the whole thing
+	size_t capacity = 4096;
+	size_t len = 0;
+	char *text = malloc(capacity);
+	size_t chunk;
+	while(text != NULL && (chunk = fread(text + len, 1, capacity - len - 1, file)) > 0){
+		len += chunk;
+		if(len + 1 == capacity){
+			capacity *= 2;
+			text = realloc(text, capacity);
+		}
+	}
+	fclose(file);
+	if(text == NULL){
+		return NULL;
+	}
+	text[len] = '\0';
+
+	// count lines then cut them apart
+	size_t count = 1;
+	for(size_t i = 0; i < len; i++){
+		if(text[i] == '\n'){
+			count++;
+		}
+	}
+	char **lines = malloc(sizeof(char *) * count);
+	if(lines == NULL){
+		return NULL;
+	}
+
+	lines[0] = text;
+	size_t index = 1;
+	for(size_t i = 0; i < len; i++){
+		if(text[i] == '\n' || text[i] == '\r'){
+			if(text[i] == '\n' && index < count){
+				lines[index++] = text + i + 1;
+			}
+			text[i] = '\0';
+		}
+	}
+
+	*lineCount = count;
+	return lines;
+}
+
+// strips the indentation so the source column lines up
+static const char *trimmed(const char *line){
+	while(*line == ' ' || *line == '\t'){
+		line++;
+	}
+
+	return line;
+}
+
+int main(int argc, char **argv){
+	if(argc < 2 || argc > 3){
+		printf("Usage: ./lexi-trace <trace_file> [source_file]\n");
+		return 0;
+	}
+
+	const char *path = argv[1];
+	FILE *file = fopen(path, "rb");
+	if(file == NULL){
+		decodeError(path, "Could not open trace");
+	}
+
+	TraceHeader header;
+	readExact(file, &header, sizeof(header), path);
+	if(memcmp(header.magic, TRACE_MAGIC, 4) != 0 || header.version != TRACE_VERSION){
+		decodeError(path, "Not a lexi trace or wrong version");
+	}
+
+	// the source recorded in the trace can be overridden on the command line
+	char *sourcePath = malloc(header.pathLen + 1);
+	uint32_t *lines = malloc(sizeof(uint32_t) * (header.codeLen + 1));
+	TraceRecord *records = malloc(sizeof(TraceRecord) * (header.recordCount + 1));
+	if(sourcePath == NULL || lines == NULL || records == NULL){
+		decodeError(path, "Not enough memory to decode trace");
+	}
+	readExact(file, sourcePath, header.pathLen, path);
+	sourcePath[header.pathLen] = '\0';
+	readExact(file, lines, sizeof(uint32_t) * header.codeLen, path);
+	readExact(file, records, sizeof(TraceRecord) * header.recordCount, path);
+	fclose(file);
+
+	size_t sourceLineCount = 0;
+	char **sourceLines = readSourceLines(argc == 3 ? argv[2] : sourcePath, &sourceLineCount);
+
+	// the first record kept is this many instructions into the run
+	uint64_t sequence = header.total - header.recordCount;
+	printf("%llu instructions executed, showing the last %u\n", (unsigned long long)header.total, header.recordCount);
+	for(uint32_t i = 0; i < header.recordCount; i++){
+		const TraceRecord *record = &records[i];
+		uint32_t line = record->pc < header.codeLen ? lines[record->pc] : 0;
+
+		printf("%10llu  %04X  %-5s ACC=%04X", (unsigned long long)(sequence + i), record->pc, traceOpcodeName(record->opcode), record->acc);
+		if(record->flags & TRACE_HAS_ADDR){
+			printf("  [%04X]", record->addr);
+		}
+		else{
+			printf("        ");
+		}
+
+		if(line > 0 && line <= sourceLineCount){
+			printf("  %4u | %s", line, trimmed(sourceLines[line - 1]));
+		}
+		putchar('\n');
+	}
+
+	return 0;
+}